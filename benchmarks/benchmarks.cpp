@@ -0,0 +1,515 @@
+#include <aabb_tree/aabb_tree.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Usage: aabb_tree_benchmarks [--size n] [--repeat r] [--seed s] [--json] [--filter substring]
+// Every result is one line (CSV with a header, or JSON objects in an array) with the best time per operation
+// of r runs. Inputs depend only on the seed, checksums must be equal for the tree and the brute force baseline.
+
+using namespace biss;
+
+namespace {
+
+struct Options {
+	biss::uint size = 100000;
+	biss::uint repeat = 5;
+	std::uint64_t seed = 1;
+	bool json = false;
+	std::string filter;
+};
+
+Options options;
+bool firstResult = true;
+
+enum class Distribution { Uniform, Clustered, Stretched };
+
+const char* name(Distribution distribution) {
+	switch (distribution) {
+		case Distribution::Uniform: return "uniform";
+		case Distribution::Clustered: return "clustered";
+		case Distribution::Stretched: return "stretched";
+	}
+	return "";
+}
+
+struct Case {
+	const char* operation;
+	Distribution distribution;
+	biss::uint dims;
+	const char* type;
+	const char* implementation;
+};
+
+void report(const Case& c, biss::uint operations, double ns, std::uint64_t checksum) {
+	if (options.json) {
+		std::printf("%s\n  {\"operation\": \"%s\", \"distribution\": \"%s\", \"dims\": %lu, \"type\": \"%s\", "
+		            "\"implementation\": \"%s\", \"size\": %lu, \"operations\": %lu, \"ns_per_op\": %.2f, "
+		            "\"checksum\": %llu}",
+		    firstResult ? "[" : ",", c.operation, name(c.distribution), c.dims, c.type, c.implementation,
+		    options.size, operations, ns / operations, (unsigned long long)checksum);
+	} else {
+		if (firstResult) {
+			std::printf("operation,distribution,dims,type,implementation,size,operations,ns_per_op,checksum\n");
+		}
+		std::printf("%s,%s,%lu,%s,%s,%lu,%lu,%.2f,%llu\n", c.operation, name(c.distribution), c.dims, c.type,
+		    c.implementation, options.size, operations, ns / operations, (unsigned long long)checksum);
+	}
+	std::fflush(stdout);
+	firstResult = false;
+}
+
+bool selected(const Case& c) {
+	if (options.filter.empty()) {
+		return true;
+	}
+	const auto id = std::string(c.operation) + "," + name(c.distribution) + "," + std::to_string(c.dims) + "," +
+	                c.type + "," + c.implementation;
+	return id.find(options.filter) != std::string::npos;
+}
+
+// Best of options.repeat runs. setup() prepares fresh state for a run and isn't timed,
+// run() returns a checksum of its results.
+template<class Setup, class Run>
+void measure(const Case& c, biss::uint operations, const Setup& setup, const Run& run) {
+	if (!selected(c)) {
+		return;
+	}
+
+	double best = 0;
+	std::uint64_t checksum = 0;
+	for (biss::uint i = 0; i != options.repeat; ++i) {
+		setup();
+		const auto start = std::chrono::steady_clock::now();
+		checksum = run();
+		const std::chrono::duration<double, std::nano> time = std::chrono::steady_clock::now() - start;
+		if (i == 0 || time.count() < best) {
+			best = time.count();
+		}
+	}
+
+	report(c, operations, best, checksum);
+}
+
+template<biss::uint N, class Type>
+class Workload {
+  public:
+	using AABB_t = AABB<N, Type>;
+	using Vec_t = Vec<N, Type>;
+	using Tree = AABBTree<biss::uint, N, Type>;
+
+	Workload(Distribution distribution, const char* type): _distribution(distribution), _type(type) {
+		_random.seed(options.seed);
+		// Constant density: about one box per unit cell
+		_worldSize = std::pow(Type(options.size), Type(1) / N);
+		_boxes.reserve(options.size);
+		for (biss::uint i = 0; i != options.size; ++i) {
+			_boxes.push_back(randomBox());
+		}
+	}
+
+	void run() {
+		bulk();
+		emplace();
+		update("update_small", Type(0.05));
+		update("update_medium", Type(1));
+		update("update_large", _worldSize);
+		remove();
+		query("query_1", Type(0.5));
+		query("query_10", Type(3));
+		query("query_100", Type(10));
+		raycast();
+		iterate();
+		pairs();
+	}
+
+  private:
+	Case makeCase(const char* operation, const char* implementation) const {
+		return Case{operation, _distribution, N, _type, implementation};
+	}
+
+	Type uniform(Type lb, Type ub) { return std::uniform_real_distribution<Type>(lb, ub)(_random); }
+
+	AABB_t randomBox() {
+		Vec_t lb;
+		Vec_t size;
+		switch (_distribution) {
+			case Distribution::Uniform: {
+				for (biss::uint i = 0; i != N; ++i) {
+					lb.point[i] = uniform(0, _worldSize);
+					size.point[i] = uniform(Type(0.25), Type(1));
+				}
+				break;
+			}
+			case Distribution::Clustered: {
+				// 64 gaussian clusters, dense spots with many overlaps
+				std::normal_distribution<Type> normal(0, _worldSize / 32);
+				std::mt19937_64 centers(options.seed + std::uniform_int_distribution<int>(0, 63)(_random));
+				for (biss::uint i = 0; i != N; ++i) {
+					lb.point[i] = std::uniform_real_distribution<Type>(0, _worldSize)(centers) + normal(_random);
+					size.point[i] = uniform(Type(0.25), Type(1));
+				}
+				break;
+			}
+			case Distribution::Stretched: {
+				// Long thin boxes along a random axis, like walls and roads
+				const auto axis = std::uniform_int_distribution<int>(0, N - 1)(_random);
+				for (biss::uint i = 0; i != N; ++i) {
+					lb.point[i] = uniform(0, _worldSize);
+					size.point[i] =
+					    i == biss::uint(axis) ? uniform(Type(5), Type(50)) : uniform(Type(0.05), Type(0.25));
+				}
+				break;
+			}
+		}
+
+		auto ub = lb;
+		ub += size;
+		return AABB_t{lb, ub};
+	}
+
+	AABB_t randomQuery(Type size) {
+		Vec_t lb;
+		for (biss::uint i = 0; i != N; ++i) {
+			lb.point[i] = uniform(0, _worldSize);
+		}
+		auto ub = lb;
+		ub += Vec_t(size);
+		return AABB_t{lb, ub};
+	}
+
+	std::vector<std::pair<AABB_t, biss::uint>> items() const {
+		std::vector<std::pair<AABB_t, biss::uint>> items;
+		items.reserve(_boxes.size());
+		for (biss::uint i = 0; i != _boxes.size(); ++i) {
+			items.emplace_back(_boxes[i], i);
+		}
+		return items;
+	}
+
+	void bulk() {
+		const auto pairs = items();
+		std::unique_ptr<Tree> tree;
+		measure(
+		    makeCase("build", "tree"), options.size, [&tree] { tree = std::make_unique<Tree>(); },
+		    [&tree, &pairs] {
+			    tree->build(pairs.begin(), pairs.end());
+			    return std::uint64_t(tree->count());
+		    });
+
+		ThreadPool pool;
+		std::vector<index_t> idxs;
+		measure(
+		    makeCase("build", "tree_parallel"), options.size,
+		    [&tree, &idxs] {
+			    tree = std::make_unique<Tree>();
+			    idxs.clear();
+		    },
+		    [&tree, &pairs, &idxs, &pool] {
+			    tree->build(pairs.begin(), pairs.end(), std::back_inserter(idxs), pool);
+			    return std::uint64_t(tree->count());
+		    });
+	}
+
+	void emplace() {
+		std::unique_ptr<Tree> tree;
+		measure(
+		    makeCase("emplace", "tree"), options.size, [&tree] { tree = std::make_unique<Tree>(); },
+		    [this, &tree] {
+			    for (biss::uint i = 0; i != _boxes.size(); ++i) {
+				    tree->emplace(_boxes[i], i);
+			    }
+			    return std::uint64_t(tree->count());
+		    });
+	}
+
+	// Move every box by a random displacement up to distance, fat AABBs absorb small moves
+	void update(const char* operation, Type distance) {
+		std::vector<AABB_t> moved(_boxes.size());
+		for (biss::uint i = 0; i != _boxes.size(); ++i) {
+			Vec_t displacement;
+			for (biss::uint j = 0; j != N; ++j) {
+				displacement.point[j] = uniform(-distance, distance);
+			}
+			moved[i] = _boxes[i];
+			moved[i].lb += displacement;
+			moved[i].ub += displacement;
+		}
+
+		const auto pairs = items();
+		std::unique_ptr<Tree> tree;
+		std::vector<index_t> idxs;
+		measure(
+		    makeCase(operation, "tree"), options.size,
+		    [&tree, &pairs, &idxs] {
+			    tree = std::make_unique<Tree>(Type(0.1));
+			    idxs.clear();
+			    tree->build(pairs.begin(), pairs.end(), std::back_inserter(idxs));
+		    },
+		    [&tree, &idxs, &moved] {
+			    for (biss::uint i = 0; i != idxs.size(); ++i) {
+				    tree->update(idxs[i], moved[i]);
+			    }
+			    return std::uint64_t(tree->count());
+		    });
+
+		std::vector<AABB_t> boxes;
+		measure(
+		    makeCase(operation, "brute_force"), options.size, [this, &boxes] { boxes = _boxes; },
+		    [&boxes, &moved] {
+			    for (biss::uint i = 0; i != boxes.size(); ++i) {
+				    boxes[i] = moved[i];
+			    }
+			    return std::uint64_t(boxes.size());
+		    });
+	}
+
+	void remove() {
+		std::vector<biss::uint> order(_boxes.size());
+		for (biss::uint i = 0; i != order.size(); ++i) {
+			order[i] = i;
+		}
+		std::shuffle(order.begin(), order.end(), _random);
+
+		const auto pairs = items();
+		std::unique_ptr<Tree> tree;
+		std::vector<index_t> idxs;
+		measure(
+		    makeCase("remove", "tree"), options.size,
+		    [&tree, &pairs, &idxs] {
+			    tree = std::make_unique<Tree>();
+			    idxs.clear();
+			    tree->build(pairs.begin(), pairs.end(), std::back_inserter(idxs));
+		    },
+		    [&tree, &idxs, &order] {
+			    for (const auto i : order) {
+				    tree->remove(idxs[i]);
+			    }
+			    return std::uint64_t(tree->count());
+		    });
+	}
+
+	// Query boxes of the given size, named after the expected number of hits with uniform boxes
+	void query(const char* operation, Type size) {
+		const biss::uint queriesCount = std::max<biss::uint>(1000, options.size / 10);
+		std::vector<AABB_t> queries;
+		queries.reserve(queriesCount);
+		for (biss::uint i = 0; i != queriesCount; ++i) {
+			queries.push_back(randomQuery(size));
+		}
+
+		const auto pairs = items();
+		const Tree tree(pairs);
+		measure(
+		    makeCase(operation, "tree"), queriesCount, [] {},
+		    [&tree, &queries] {
+			    std::uint64_t checksum = 0;
+			    for (const auto& query : queries) {
+				    tree.query(query, [&tree, &checksum](typename Tree::Handle hit) {
+					    checksum += *hit + 1;
+					    return true;
+				    });
+			    }
+			    return checksum;
+		    });
+
+		measure(
+		    makeCase(operation, "brute_force"), queriesCount, [] {},
+		    [this, &queries] {
+			    std::uint64_t checksum = 0;
+			    for (const auto& query : queries) {
+				    for (biss::uint i = 0; i != _boxes.size(); ++i) {
+					    if (_boxes[i].isIntersecting(query)) {
+						    checksum += i + 1;
+					    }
+				    }
+			    }
+			    return checksum;
+		    });
+	}
+
+	// Closest hit of segments crossing a quarter of the world. Origins inside several boxes make the closest box
+	// ambiguous, so checksum counts segments that hit anything.
+	void raycast() {
+		const biss::uint raysCount = std::max<biss::uint>(1000, options.size / 10);
+		std::vector<std::pair<Vec_t, Vec_t>> rays;
+		for (biss::uint i = 0; i != raysCount; ++i) {
+			Vec_t origin;
+			Vec_t direction;
+			for (biss::uint j = 0; j != N; ++j) {
+				origin.point[j] = uniform(0, _worldSize);
+				direction.point[j] = uniform(-_worldSize / 4, _worldSize / 4);
+			}
+			rays.emplace_back(origin, direction);
+		}
+
+		using Real_t = typename Tree::Real_t;
+		const auto pairs = items();
+		const Tree tree(pairs);
+		measure(
+		    makeCase("raycast", "tree"), raysCount, [] {},
+		    [&tree, &rays] {
+			    std::uint64_t checksum = 0;
+			    for (const auto& [origin, direction] : rays) {
+				    bool hit = false;
+				    tree.raycast(origin, direction, Real_t(1), [&hit](index_t, Real_t fraction) {
+					    hit = true;
+					    return fraction;
+				    });
+				    checksum += hit;
+			    }
+			    return checksum;
+		    });
+
+		measure(
+		    makeCase("raycast", "brute_force"), raysCount, [] {},
+		    [this, &rays] {
+			    std::uint64_t checksum = 0;
+			    for (const auto& [origin, direction] : rays) {
+				    Real_t closest = 2;
+				    for (biss::uint i = 0; i != _boxes.size(); ++i) {
+					    Real_t fraction;
+					    if (slab(_boxes[i], origin, direction, fraction) && fraction < closest) {
+						    closest = fraction;
+					    }
+				    }
+				    checksum += closest <= 1;
+			    }
+			    return checksum;
+		    });
+	}
+
+	template<class Real>
+	static bool slab(const AABB_t& aabb, const Vec_t& origin, const Vec_t& direction, Real& fraction) {
+		Real tmin = 0;
+		Real tmax = 1;
+		for (biss::uint i = 0; i != N; ++i) {
+			if (direction.point[i] == Type{0}) {
+				if (origin.point[i] < aabb.lb.point[i] || origin.point[i] > aabb.ub.point[i]) {
+					return false;
+				}
+				continue;
+			}
+			auto t1 = Real(aabb.lb.point[i] - origin.point[i]) / Real(direction.point[i]);
+			auto t2 = Real(aabb.ub.point[i] - origin.point[i]) / Real(direction.point[i]);
+			if (t1 > t2) {
+				std::swap(t1, t2);
+			}
+			tmin = std::max(tmin, t1);
+			tmax = std::min(tmax, t2);
+			if (tmin > tmax) {
+				return false;
+			}
+		}
+		fraction = tmin;
+		return true;
+	}
+
+	void iterate() {
+		const auto pairs = items();
+		const Tree tree(pairs);
+		measure(
+		    makeCase("iterate", "tree"), options.size, [] {},
+		    [&tree] {
+			    std::uint64_t checksum = 0;
+			    for (auto it = tree.begin(); it != tree.end(); ++it) {
+				    checksum += *it + 1;
+			    }
+			    return checksum;
+		    });
+	}
+
+	// All overlapping pairs, brute force only for small sizes
+	void pairs() {
+		const auto pairs = items();
+		const Tree tree(pairs);
+		measure(
+		    makeCase("pairs", "tree"), options.size, [] {},
+		    [&tree] {
+			    std::uint64_t checksum = 0;
+			    tree.queryPairs([&checksum](index_t, index_t) {
+				    ++checksum;
+				    return true;
+			    });
+			    return checksum;
+		    });
+
+		if (options.size > 20000) {
+			return;
+		}
+		measure(
+		    makeCase("pairs", "brute_force"), options.size, [] {},
+		    [this] {
+			    std::uint64_t checksum = 0;
+			    for (biss::uint i = 0; i != _boxes.size(); ++i) {
+				    for (biss::uint j = i + 1; j != _boxes.size(); ++j) {
+					    checksum += _boxes[i].isIntersecting(_boxes[j]);
+				    }
+			    }
+			    return checksum;
+		    });
+	}
+
+  private:
+	Distribution _distribution;
+	const char* _type;
+	std::mt19937_64 _random;
+	Type _worldSize;
+	std::vector<AABB_t> _boxes;
+};
+
+template<biss::uint N, class Type>
+void runAll(const char* type) {
+	for (const auto distribution : {Distribution::Uniform, Distribution::Clustered, Distribution::Stretched}) {
+		Workload<N, Type>(distribution, type).run();
+	}
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	for (int i = 1; i < argc; ++i) {
+		const auto next = [&](const char* arg) {
+			if (i + 1 >= argc) {
+				std::fprintf(stderr, "%s requires a value\n", arg);
+				std::exit(1);
+			}
+			return argv[++i];
+		};
+
+		if (!std::strcmp(argv[i], "--size")) {
+			options.size = std::strtoul(next(argv[i]), nullptr, 10);
+		} else if (!std::strcmp(argv[i], "--repeat")) {
+			options.repeat = std::max(1ul, std::strtoul(next(argv[i]), nullptr, 10));
+		} else if (!std::strcmp(argv[i], "--seed")) {
+			options.seed = std::strtoull(next(argv[i]), nullptr, 10);
+		} else if (!std::strcmp(argv[i], "--filter")) {
+			options.filter = next(argv[i]);
+		} else if (!std::strcmp(argv[i], "--json")) {
+			options.json = true;
+		} else {
+			std::fprintf(stderr,
+			    "Usage: %s [--size n] [--repeat r] [--seed s] [--json] [--filter substring]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	runAll<2, float>("float");
+	runAll<2, double>("double");
+	runAll<3, float>("float");
+	runAll<3, double>("double");
+
+	if (options.json) {
+		std::printf(firstResult ? "[]\n" : "\n]\n");
+	}
+
+	return 0;
+}
@@ -10,6 +10,14 @@ Type get_lb(uint i, const UserAABBType& aabb);
 template<class UserAABBType, class Type>
 Type get_ub(uint i, const UserAABBType& aabb);
 
+namespace simd {
+// Specialised in aabb_simd.hpp
+template<uint N, class Type>
+struct AABBKernels {
+	static constexpr bool enabled = false;
+};
+} // namespace simd
+
 template<uint N, class Type>
 struct AABB {
 	using Vec_t = biss::Vec<N, Type>;
@@ -21,6 +29,11 @@ struct AABB {
 	AABB() = default;
 
 	auto& unite(const AABB& other) {
+		if constexpr (simd::AABBKernels<N, Type>::enabled) {
+			simd::AABBKernels<N, Type>::unite(*this, other);
+			return *this;
+		}
+
 		for (uint i = 0; i != N; ++i) {
 			if (lb.point[i] > other.lb.point[i]) {
 				lb.point[i] = other.lb.point[i];
@@ -34,24 +47,24 @@ struct AABB {
 	}
 
 	bool isIntersecting(const AABB& other) const {
-		const auto d1 = other.lb - ub;
-		for (uint i = 0; i != N; ++i) {
-			if (d1.point[i] > 0) {
-				return false;
-			}
+		if constexpr (simd::AABBKernels<N, Type>::enabled) {
+			return simd::AABBKernels<N, Type>::isIntersecting(*this, other);
 		}
 
-		const auto d2 = lb - other.ub;
+		// Branch-free, all axes are checked
+		bool result = true;
 		for (uint i = 0; i != N; ++i) {
-			if (d2.point[i] > 0) {
-				return false;
-			}
+			result &= (other.lb.point[i] <= ub.point[i]) & (lb.point[i] <= other.ub.point[i]);
 		}
 
-		return true;
+		return result;
 	}
 
 	bool contains(const AABB& other) const {
+		if constexpr (simd::AABBKernels<N, Type>::enabled) {
+			return simd::AABBKernels<N, Type>::contains(*this, other);
+		}
+
 		for (uint i = 0; i != N; ++i) {
 			if (lb.point[i] > other.lb.point[i] || ub.point[i] < other.ub.point[i]) {
 				return false;
@@ -60,6 +73,23 @@ struct AABB {
 		return true;
 	}
 
+	// Squared distance between closest points, 0 for intersecting boxes
+	template<class Real = Type>
+	Real sqDistance(const AABB& other) const {
+		Real d = 0;
+		for (uint i = 0; i != N; ++i) {
+			Real gap = 0;
+			if (other.lb.point[i] > ub.point[i]) {
+				gap = Real(other.lb.point[i]) - Real(ub.point[i]);
+			} else if (lb.point[i] > other.ub.point[i]) {
+				gap = Real(lb.point[i]) - Real(other.ub.point[i]);
+			}
+			d += gap * gap;
+		}
+
+		return d;
+	}
+
 	// for 2d perimeter
 	// for 3d area
 	Type area() const {
@@ -101,9 +131,19 @@ struct AABB {
 	}
 };
 
+// Half-space of points x with dot(normal, x) <= distance, normal points outwards.
+// Normal doesn't have to be unit length.
+template<uint N, class Type>
+struct Plane {
+	Vec<N, Type> normal;
+	Type distance;
+};
+
 template<class Type, uint N>
 AABB<N, Type> unite(const AABB<N, Type>& aabb1, const AABB<N, Type>& aabb2) {
 	return AABB<N, Type>{aabb1}.unite(aabb2);
 }
 
-} // namespace biss
\ No newline at end of file
+} // namespace biss
+
+#include "aabb_simd.hpp"
\ No newline at end of file
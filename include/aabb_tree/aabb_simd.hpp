@@ -0,0 +1,122 @@
+#pragma once
+
+// SSE kernels for the most common AABB instantiations, included from aabb.hpp.
+// Boxes are loaded in place without padding: lb and ub are adjacent in memory, so partially overlapping
+// loads cover a box exactly and never read past its end.
+// Define AABB_TREE_NO_SIMD to use scalar code only.
+
+#if !defined(AABB_TREE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define AABB_TREE_SIMD 1
+#include <emmintrin.h>
+#endif
+
+namespace biss::simd {
+
+#ifdef AABB_TREE_SIMD
+
+template<>
+struct AABBKernels<2, float> {
+	static constexpr bool enabled = true;
+	static_assert(sizeof(AABB<2, float>) == 4 * sizeof(float));
+
+	// [lb0, lb1, ub0, ub1]
+	static __m128 load(const AABB<2, float>& a) { return _mm_loadu_ps(a.lb.point); }
+
+	static bool isIntersecting(const AABB<2, float>& a, const AABB<2, float>& b) {
+		const auto va = load(a);
+		const auto vb = load(b);
+		// [b.lb, a.lb] <= [a.ub, b.ub]
+		const auto le = _mm_cmple_ps(_mm_movelh_ps(vb, va), _mm_movehl_ps(vb, va));
+		return _mm_movemask_ps(le) == 0xF;
+	}
+
+	static bool contains(const AABB<2, float>& a, const AABB<2, float>& b) {
+		const auto va = load(a);
+		const auto vb = load(b);
+		// [a.lb, b.ub] <= [b.lb, a.ub]
+		const auto le = _mm_cmple_ps(_mm_shuffle_ps(va, vb, _MM_SHUFFLE(3, 2, 1, 0)),
+		    _mm_shuffle_ps(vb, va, _MM_SHUFFLE(3, 2, 1, 0)));
+		return _mm_movemask_ps(le) == 0xF;
+	}
+
+	static void unite(AABB<2, float>& a, const AABB<2, float>& b) {
+		const auto va = load(a);
+		const auto vb = load(b);
+		const auto mn = _mm_min_ps(va, vb);
+		const auto mx = _mm_max_ps(va, vb);
+		_mm_storeu_ps(a.lb.point, _mm_shuffle_ps(mn, mx, _MM_SHUFFLE(3, 2, 1, 0)));
+	}
+};
+
+template<>
+struct AABBKernels<3, float> {
+	static constexpr bool enabled = true;
+	static_assert(sizeof(AABB<3, float>) == 6 * sizeof(float));
+
+	// [lb0, lb1, lb2, ub0]
+	static __m128 loadLow(const AABB<3, float>& a) { return _mm_loadu_ps(a.lb.point); }
+	// [lb2, ub0, ub1, ub2]
+	static __m128 loadHigh(const AABB<3, float>& a) { return _mm_loadu_ps(a.lb.point + 2); }
+	// [ub0, ub1, ub2, ub2]
+	static __m128 upper(__m128 high) { return _mm_shuffle_ps(high, high, _MM_SHUFFLE(3, 3, 2, 1)); }
+
+	static bool isIntersecting(const AABB<3, float>& a, const AABB<3, float>& b) {
+		const auto le = _mm_and_ps(_mm_cmple_ps(loadLow(b), upper(loadHigh(a))),
+		    _mm_cmple_ps(loadLow(a), upper(loadHigh(b))));
+		return (_mm_movemask_ps(le) & 0x7) == 0x7;
+	}
+
+	static bool contains(const AABB<3, float>& a, const AABB<3, float>& b) {
+		const auto lbLe = _mm_cmple_ps(loadLow(a), loadLow(b));
+		const auto ubLe = _mm_cmple_ps(loadHigh(b), loadHigh(a));
+		return (_mm_movemask_ps(lbLe) & 0x7) == 0x7 && (_mm_movemask_ps(ubLe) & 0xE) == 0xE;
+	}
+
+	static void unite(AABB<3, float>& a, const AABB<3, float>& b) {
+		const auto mn = _mm_min_ps(loadLow(a), loadLow(b));
+		const auto mx = _mm_max_ps(loadHigh(a), loadHigh(b));
+		// [mn2, mx1, mx2, mx3], lane 0 of the high part is lb2
+		const auto high = _mm_move_ss(mx, _mm_shuffle_ps(mn, mn, _MM_SHUFFLE(2, 2, 2, 2)));
+		// Second store overwrites the garbage lane 3 of the first one
+		_mm_storeu_ps(a.lb.point, mn);
+		_mm_storeu_ps(a.lb.point + 2, high);
+	}
+};
+
+template<>
+struct AABBKernels<3, double> {
+	static constexpr bool enabled = true;
+	static_assert(sizeof(AABB<3, double>) == 6 * sizeof(double));
+
+	static bool isIntersecting(const AABB<3, double>& a, const AABB<3, double>& b) {
+		const auto le01 = _mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(b.lb.point), _mm_loadu_pd(a.ub.point)),
+		    _mm_cmple_pd(_mm_loadu_pd(a.lb.point), _mm_loadu_pd(b.ub.point)));
+		const auto le2 = _mm_and_pd(_mm_cmple_sd(_mm_load_sd(b.lb.point + 2), _mm_load_sd(a.ub.point + 2)),
+		    _mm_cmple_sd(_mm_load_sd(a.lb.point + 2), _mm_load_sd(b.ub.point + 2)));
+		return (_mm_movemask_pd(le01) | (_mm_movemask_pd(le2) & 1) << 2) == 0x7;
+	}
+
+	static bool contains(const AABB<3, double>& a, const AABB<3, double>& b) {
+		const auto le01 = _mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(a.lb.point), _mm_loadu_pd(b.lb.point)),
+		    _mm_cmple_pd(_mm_loadu_pd(b.ub.point), _mm_loadu_pd(a.ub.point)));
+		const auto le2 = _mm_and_pd(_mm_cmple_sd(_mm_load_sd(a.lb.point + 2), _mm_load_sd(b.lb.point + 2)),
+		    _mm_cmple_sd(_mm_load_sd(b.ub.point + 2), _mm_load_sd(a.ub.point + 2)));
+		return (_mm_movemask_pd(le01) | (_mm_movemask_pd(le2) & 1) << 2) == 0x7;
+	}
+
+	static void unite(AABB<3, double>& a, const AABB<3, double>& b) {
+		// [lb0, lb1], [lb2, ub0], [ub1, ub2]
+		const auto lb01 = _mm_min_pd(_mm_loadu_pd(a.lb.point), _mm_loadu_pd(b.lb.point));
+		const auto lb2 = _mm_min_sd(_mm_load_sd(a.lb.point + 2), _mm_load_sd(b.lb.point + 2));
+		const auto ub01 = _mm_max_pd(_mm_loadu_pd(a.ub.point), _mm_loadu_pd(b.ub.point));
+		const auto ub2 = _mm_max_sd(_mm_load_sd(a.ub.point + 2), _mm_load_sd(b.ub.point + 2));
+		_mm_storeu_pd(a.lb.point, lb01);
+		_mm_store_sd(a.lb.point + 2, lb2);
+		_mm_storeu_pd(a.ub.point, ub01);
+		_mm_store_sd(a.ub.point + 2, ub2);
+	}
+};
+
+#endif
+
+} // namespace biss::simd
@@ -1,19 +1,94 @@
 #pragma once
 
 #include "aabb.hpp"
+#include "aabb_tree_handle.hpp"
 #include "aabb_tree_iterator.hpp"
+#include "aabb_tree_snapshot.hpp"
+#include "aabb_tree_stats.hpp"
 #include "growable_stack.hpp"
 #include "indexer.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <queue>
+#include <ranges>
+#include <span>
+#include <vector>
 
 namespace biss {
 
+template<class ValueType, uint N, class KeyElementType, uint Width>
+class WideAABBTree;
+template<class ValueType, uint N, class KeyElementType>
+class AABBTreeView;
+template<class ValueType, uint N, class KeyElementType, class QuantType>
+class FrozenAABBTree;
+
+// Const member functions only read the tree, any number of threads may call them concurrently
+// as long as nobody modifies the tree at the same time.
 template<class ValueType, uint N, class KeyElementType>
 class AABBTree {
   public:
 	using AABB_t = AABB<N, KeyElementType>;
-	using Iterator = AABBTreeIterator<ValueType>;
+	// Small trivially copyable values are stored right in leaf nodes instead of a separate array,
+	// so a hit costs one cache miss less
+	static constexpr bool INLINE_VALUES = std::is_trivially_copyable_v<ValueType> &&
+	                                      sizeof(ValueType) <= sizeof(index_t) && alignof(ValueType) <= alignof(index_t);
+	using Iterator = std::conditional_t<INLINE_VALUES, AABBTreeLeafIterator<AABBTree, ValueType>,
+	    AABBTreeIterator<ValueType>>;
+	using Handle = AABBTreeHandle<ValueType>;
+	// Floating point type for fractions and costs, double for integer keys
+	using Real_t = std::conditional_t<std::is_floating_point_v<KeyElementType>, KeyElementType, double>;
+	using Stats = AABBTreeStats<Real_t>;
+	using Plane_t = Plane<N, Real_t>;
+	static constexpr uint MAX_CONVEX_PLANES = 32;
+
+	// Node order in memory after compact()
+	enum class Layout {
+		DepthFirst, // parent is followed by its first subtree
+		VanEmdeBoas // recursively split by height, close nodes stay close on every scale
+	};
 
-	explicit AABBTree(KeyElementType aabbExtension = 0, KeyElementType aabbMultiplier = 0) noexcept;
+	// Nodes and data are allocated from separate resources, std::malloc/std::free for nullptr.
+	// The tree never outlives its storage: with trivially destructible values destruction only returns
+	// blocks to the resources, so a monotonic arena can drop them all at once.
+	explicit AABBTree(KeyElementType aabbExtension = 0, KeyElementType aabbMultiplier = 0,
+	    std::pmr::memory_resource* nodesResource = nullptr, std::pmr::memory_resource* dataResource = nullptr) noexcept;
+	// Bulk load from a range of {aabb, value} pairs, see build()
+	template<std::ranges::input_range Range>
+	explicit AABBTree(const Range& range, KeyElementType aabbExtension = 0, KeyElementType aabbMultiplier = 0,
+	    std::pmr::memory_resource* nodesResource = nullptr, std::pmr::memory_resource* dataResource = nullptr);
+
+	// Copies keep leaf indices and memory resources. Assignment reuses storage of the same capacity,
+	// see AABBTreeSnapshots.
+	AABBTree(const AABBTree& other);
+	AABBTree& operator=(const AABBTree& other) = default;
+	// Storage moves with its resources, the source is left empty and usable
+	AABBTree(AABBTree&& other) noexcept;
+	AABBTree& operator=(AABBTree&& other) noexcept;
+
+	// Insert all {aabb, value} pairs of [first, last) and rebuild the whole hierarchy top-down (binned SAH).
+	// Much faster and gives a better tree than emplace() per object.
+	template<std::input_iterator InputIt>
+	void build(InputIt first, InputIt last);
+	// Same as above, leaf indices of inserted objects are written to idxs
+	template<std::input_iterator InputIt, class OutputIt>
+	OutputIt build(InputIt first, InputIt last, OutputIt idxs);
+	// Same as above, subtrees are built concurrently on executor workers (see ThreadPool).
+	// The hierarchy is the same as of build() for any number of workers.
+	template<std::input_iterator InputIt, class OutputIt, class Executor>
+	OutputIt build(InputIt first, InputIt last, OutputIt idxs, Executor& executor);
 
 	template<class... Args>
 	index_t emplace(const AABB_t& aabb, Args&&... args);
@@ -22,69 +97,340 @@ class AABBTree {
 
 	void remove(index_t idx);
 
+	// callback(Handle) -> bool is called for every leaf intersecting aabb, return false to stop.
+	// Callbacks that only accept Iterator get one instead.
 	template<typename T>
 	void query(const AABB_t& aabb, const T& callback) const;
 	template<class AABBType, typename T>
 	void query(const AABBType& aabb, const T& callback) const;
+	// Append indices of all leaves intersecting aabb to hits, returns number of appended leaves
+	uint query(const AABB_t& aabb, std::vector<index_t>& hits) const;
+	// Same as query(), but walks the tree back up through parent links instead of keeping a stack.
+	// Uses constant memory and never allocates, good for fibers and coroutines with small stacks.
+	template<typename T>
+	void queryStackless(const AABB_t& aabb, const T& callback) const;
+
+	// Report every leaf whose (fat) AABB is not fully outside any of planes, same callback as query().
+	// For a convex polytope such as a view frustum that is a conservative intersection test.
+	// Planes a node is fully inside are not tested again below it, subtrees inside all planes are reported
+	// without tests. Planes are tracked in a 32 bit mask: returns false without reporting anything
+	// for more than MAX_CONVEX_PLANES planes.
+	template<typename T>
+	bool queryConvex(std::span<const Plane_t> planes, const T& callback) const;
+
+	// Run query() for every box of boxes on executor workers (see ThreadPool),
+	// callback(uint boxIdx, index_t) -> bool is called concurrently, return false to stop the query of that box.
+	template<typename T, class Executor>
+	void queryBatch(std::span<const AABB_t> boxes, const T& callback, Executor& executor) const;
+
+	// Report every pair of leaves with overlapping tree (fat) AABBs exactly once.
+	// callback(index_t, index_t) -> bool, return false to stop.
+	template<typename T>
+	void queryPairs(const T& callback) const;
+	// Same, but only pairs where at least one leaf was emplaced or reinserted by update() since the last call.
+	// The move buffer is cleared even if callback stops the query.
+	template<typename T>
+	void queryMovedPairs(const T& callback);
+
+	// Cast segment origin + t * direction, t in [0, maxFraction] against tree (fat) AABBs, nearest boxes first.
+	// callback(index_t, Real_t fraction) -> Real_t gets the fraction where the segment enters the leaf AABB.
+	// Return value controls the rest of the cast:
+	//   0                 - stop (any hit)
+	//   (0, maxFraction)  - clip the segment to it (closest hit)
+	//   maxFraction       - keep going (all hits)
+	//   negative          - ignore this leaf
+	template<typename T>
+	void raycast(const typename AABB_t::Vec_t& origin, const typename AABB_t::Vec_t& direction, Real_t maxFraction,
+	    const T& callback) const;
+	template<class VecType, typename T>
+	void raycast(const VecType& origin, const VecType& direction, Real_t maxFraction, const T& callback) const;
+
+	// Report up to k leaves nearest to aabb/point closest first, measured to tree (fat) AABBs.
+	// Leaves farther than maxDistance are skipped.
+	// callback(index_t, Real_t sqDistance) -> bool, return false to stop.
+	template<typename T>
+	void nearest(const AABB_t& aabb, uint k, const T& callback,
+	    Real_t maxDistance = std::numeric_limits<Real_t>::max()) const;
+	template<typename T>
+	void nearest(const typename AABB_t::Vec_t& point, uint k, const T& callback,
+	    Real_t maxDistance = std::numeric_limits<Real_t>::max()) const;
 
 	void update(
 	    index_t idx, const AABB_t& aabb, const typename AABB_t::Vec_t& displacement = typename AABB_t::Vec_t(0));
 	template<class AABBType, class VecType>
 	void update(index_t idx, const AABBType& aabb, const VecType& displacement = VecType{});
 
+	// Batched update(): leaves that escaped their fat AABB are reinserted first,
+	// then all touched ancestors are refitted and balanced once in a single bottom-up pass.
+	// displacements can be empty or must have the same size as idxs.
+	void updateMany(std::span<const index_t> idxs, std::span<const AABB_t> aabbs,
+	    std::span<const typename AABB_t::Vec_t> displacements = {});
+
+	// SAH cost of the hierarchy: total area of internal nodes relative to the root area
+	Real_t cost() const;
+	// Improve the tree by rebuilding subtrees with binned SAH, about budget leaves in total per call.
+	// Subtrees are taken round-robin continuing where the previous call stopped, so repeated calls
+	// with a small budget (e.g. once per frame) eventually fix the whole tree. Returns number of rebuilt leaves.
+	uint optimize(uint budget);
+	// Rebuild the whole hierarchy over current leaves (binned SAH), leaf indices stay valid
+	void rebuild();
+	// Same, on executor workers like build()
+	template<class Executor>
+	void rebuild(Executor& executor);
+	// emplace()/remove()/update()/updateMany() rebuild the tree once cost() exceeds ratio * cost() after
+	// the last rebuild. 0 disables it (default).
+	void setRebuildRatio(Real_t ratio);
+
+	// Shape of the tree and, with AABB_TREE_STATS defined as 1, counters of queries, rotations and updates.
+	// Shape is computed on call in O(1), counters are relaxed atomics.
+	Stats stats() const;
+	void resetStats();
+
 	ValueType& operator[](index_t idx);
 	const ValueType& operator[](index_t idx) const;
 
 	uint count() const;
 
-	Iterator begin() const { return Iterator(_data.begin()); }
-	Iterator end() const { return Iterator(_data.end()); }
+	// Preallocate storage for nodes and objects, a tree of n objects has 2 * n - 1 nodes.
+	// Returns false if allocation failed.
+	bool reserve(uint nodesCount, uint objectsCount);
+	// Release unused storage at the end of node and object arrays
+	bool shrinkToFit();
+	// Renumber nodes in layout order into a tightly packed array, so traversals touch fewer cache lines.
+	// Leaf indices change: returns remap where remap[oldIdx] is the new index of leaf oldIdx.
+	std::vector<index_t> compact(Layout layout = Layout::DepthFirst);
+
+	// Write a snapshot that AABBTreeView can query in place, values must be trivially copyable.
+	// Nodes and values are stored as memory images, so the file is only readable by the same tree type
+	// on a machine with the same byte order. Returns false on stream errors.
+	bool save(std::ostream& stream) const;
+	bool save(const std::filesystem::path& path) const;
+
+	Iterator begin() const;
+	Iterator end() const;
 
   private:
+	template<class, uint, class, uint>
+	friend class WideAABBTree;
+	friend class AABBTreeView<ValueType, N, KeyElementType>;
+	template<class, uint, class, class>
+	friend class FrozenAABBTree;
+	friend class AABBTreeLeafIterator<AABBTree, ValueType>;
+
 	struct Node {
 		AABB_t aabb;
 
 		index_t parent;
 		index_t child1;
-		index_t child2;
+		// Leaves have no children: child1 is nullindex and the second slot holds the data index
+		// or the value itself with INLINE_VALUES
+		union {
+			index_t child2;
+			index_t dataIdx;
+			alignas(index_t) unsigned char valueStorage[sizeof(index_t)];
+		};
 
-		uint height;
+		std::uint16_t height;
 
-		index_t dataIdx;
+		// Leaf position in the move buffer, see queryMovedPairs()
+		enum class MoveState : std::uint8_t { None, Buffered, Collected } moveState;
 
-		bool isLeaf() const {
-			assert(child1 != nullindex || child1 == child2);
-			return child1 == nullindex;
-		}
+		bool isLeaf() const { return child1 == nullindex; }
+
+		ValueType& value() { return *std::launder(reinterpret_cast<ValueType*>(valueStorage)); }
+		const ValueType& value() const { return *std::launder(reinterpret_cast<const ValueType*>(valueStorage)); }
 	};
+	// Size targets with the default 32 bit indices: two nodes per cache line in 2D, one 48 byte slot in 3D
+	static_assert(sizeof(index_t) != 4 || !std::is_same_v<KeyElementType, float> || N != 2 || sizeof(Node) == 32);
+	static_assert(sizeof(index_t) != 4 || !std::is_same_v<KeyElementType, float> || N != 3 || sizeof(Node) <= 48);
 
   private:
+	static constexpr uint BUILD_BINS_COUNT = 16;
+	// Parallel build splits ranges of more items level by level, smaller ones are built by one worker each
+	static constexpr uint PARALLEL_BUILD_GRAIN = 4096;
+	// Height of nodes marked by refit(std::span) until the pass recomputes it, trees never get that tall
+	static constexpr std::uint16_t REFIT_PENDING = std::numeric_limits<std::uint16_t>::max();
+
+	// Leaf bounds copied out of _nodes so that builder works on contiguous memory
+	struct BuildItem {
+		AABB_t aabb;
+		Real_t centroid[N]; // doubled, no need to divide by 2 for comparisons
+		index_t leafIdx;
+	};
+
+	template<class... Args>
+	index_t createLeaf(const AABB_t& aabb, Args&&... args);
+
 	void insertLeaf(index_t leafIdx);
 	void removeLeaf(index_t leafIdx);
 
+	// Link/unlink leaf without fixing ancestors, returns node from which ancestors should be refitted
+	index_t attachLeaf(index_t leafIdx);
+	index_t detachLeaf(index_t leafIdx);
+
+	// Balance and refit idx and all its ancestors
+	void refit(index_t idx);
+	// Same for union of paths to the root from all idxs. Freed slots in idxs are skipped.
+	void refit(std::span<const index_t> idxs);
+
+	// Calculate new fat AABB, returns false if the tree AABB can be kept
+	bool needsReinsert(
+	    index_t idx, const AABB_t& aabb, const typename AABB_t::Vec_t& displacement, AABB_t& extAABB) const;
+
 	index_t balance(index_t iA);
 
+	// Set aabb of internal node keeping _internalArea up to date
+	void setInternalAABB(Node& node, const AABB_t& aabb);
+	void rebuildIfDegraded();
+	// Rebuild subtree at idx reusing its internal node slots, returns number of its leaves
+	uint rebuildSubtree(index_t idx);
+
+	// Append nodes of the top depth levels of subtree idx to order in van Emde Boas order
+	void vanEmdeBoasOrder(index_t idx, uint depth, std::vector<index_t>& order) const;
+
+	// Next leaf in node slot order after idx, nullindex if there is none
+	index_t nextLeaf(index_t idx) const;
+	ValueType& leafValue(index_t leafIdx) const;
+
+	// Traversal behind all box queries, callback(index_t leafIdx) -> bool. Returns false if callback stopped it.
+	template<typename T>
+	bool queryLeaves(const AABB_t& aabb, const T& callback, GrowableStack<index_t, 256>& stack) const;
+	template<typename T>
+	bool queryLeavesStackless(const AABB_t& aabb, const T& callback) const;
+	void countQuery(uint visited, uint leaves) const;
+	// Pass leaf to query() callback as Handle or Iterator, whatever it accepts
+	template<typename T>
+	bool callHit(const T& callback, index_t leafIdx) const;
+
+	struct Ray {
+		Real_t origin[N];
+		Real_t direction[N];
+		Real_t invDirection[N];
+	};
+	// Slab test, on hit fraction is the entry point of the segment into aabb (AABB of any element type)
+	template<class Box>
+	static bool raycast(const Box& aabb, const Ray& ray, Real_t maxFraction, Real_t& fraction);
+
+	// Release all objects and nodes keeping memory resources, used by moves
+	void reset();
+
+	void bufferMove(index_t leafIdx);
+	// Drop entries of removed leaves and duplicates from the move buffer
+	void compactMoveBuffer(typename Node::MoveState state);
+
+	// Create leaves for all {aabb, value} pairs of [first, last) and append them to items
+	template<std::input_iterator InputIt, class OutputIt>
+	OutputIt createLeaves(InputIt first, InputIt last, OutputIt idxs, std::vector<BuildItem>& items);
+	// Append all leaves to items and release internal nodes
+	void collectLeaves(std::vector<BuildItem>& items);
+	// Copy bounds of collected leaves into items[0, count)
+	void fillItems(BuildItem* items, uint count) const;
+	// Build hierarchy over collected leaves
+	void buildItems(std::vector<BuildItem>& items);
+	template<class Executor>
+	void buildItems(std::vector<BuildItem>& items, Executor& executor);
+	// Build hierarchy over items[0, count), internal[0, count - 1) are free node slots used for internal nodes.
+	// Only touches nodes of these items and slots, areas of created nodes are added to internalArea.
+	index_t buildSubtree(BuildItem* items, uint count, const index_t* internal, double& internalArea);
+	static uint findSplit(BuildItem* items, uint count);
+
   private:
-	const KeyElementType _aabbExtension;
-	const KeyElementType _aabbMultiplier;
+	KeyElementType _aabbExtension;
+	KeyElementType _aabbMultiplier;
 
 	Indexer<Node> _nodes;
 	Indexer<AABBTreeData<ValueType>> _data;
 	index_t _root;
+
+	// Leaves moved since the last queryMovedPairs(), may hold stale entries until compaction
+	std::pmr::vector<index_t> _moveBuffer;
+
+	// Sum of internal node areas, see cost()
+	double _internalArea = 0;
+	Real_t _rebuildRatio = 0;
+	Real_t _rebuildCost = 0;
+	index_t _optimizeCursor = 0;
+
+	[[no_unique_address]] AABBTreeCounters<AABB_TREE_STATS> _counters;
 };
 
 template<class ValueType, uint N, class KeyElementType>
-AABBTree<ValueType, N, KeyElementType>::AABBTree(KeyElementType aabbExtension, KeyElementType aabbMultiplier) noexcept:
-    _root(nullindex), _nodes(0), _aabbExtension(aabbExtension), _aabbMultiplier(aabbMultiplier) {
+AABBTree<ValueType, N, KeyElementType>::AABBTree(KeyElementType aabbExtension, KeyElementType aabbMultiplier,
+    std::pmr::memory_resource* nodesResource, std::pmr::memory_resource* dataResource) noexcept:
+    _aabbExtension(aabbExtension), _aabbMultiplier(aabbMultiplier), _nodes(0, nodesResource),
+    _data(0, dataResource), _root(nullindex),
+    _moveBuffer(nodesResource ? nodesResource : std::pmr::get_default_resource()) {
+}
+
+template<class ValueType, uint N, class KeyElementType>
+AABBTree<ValueType, N, KeyElementType>::AABBTree(const AABBTree& other):
+    _aabbExtension(other._aabbExtension), _aabbMultiplier(other._aabbMultiplier), _nodes(other._nodes),
+    _data(other._data), _root(other._root), _moveBuffer(other._moveBuffer, other._moveBuffer.get_allocator()),
+    _internalArea(other._internalArea), _rebuildRatio(other._rebuildRatio), _rebuildCost(other._rebuildCost),
+    _optimizeCursor(other._optimizeCursor), _counters(other._counters) {
+}
+
+template<class ValueType, uint N, class KeyElementType>
+AABBTree<ValueType, N, KeyElementType>::AABBTree(AABBTree&& other) noexcept:
+    _aabbExtension(other._aabbExtension), _aabbMultiplier(other._aabbMultiplier), _nodes(std::move(other._nodes)),
+    _data(std::move(other._data)), _root(other._root), _moveBuffer(std::move(other._moveBuffer)),
+    _internalArea(other._internalArea), _rebuildRatio(other._rebuildRatio), _rebuildCost(other._rebuildCost),
+    _optimizeCursor(other._optimizeCursor), _counters(other._counters) {
+	other.reset();
+}
+
+template<class ValueType, uint N, class KeyElementType>
+AABBTree<ValueType, N, KeyElementType>& AABBTree<ValueType, N, KeyElementType>::operator=(AABBTree&& other) noexcept {
+	if (this == &other) {
+		return *this;
+	}
+
+	// Indexers swap storage, old nodes and objects of this tree are released by other.reset()
+	_aabbExtension = other._aabbExtension;
+	_aabbMultiplier = other._aabbMultiplier;
+	_nodes = std::move(other._nodes);
+	_data = std::move(other._data);
+	_root = other._root;
+	// Allocators don't propagate, with different ones elements are moved one by one
+	_moveBuffer = std::move(other._moveBuffer);
+	_internalArea = other._internalArea;
+	_rebuildRatio = other._rebuildRatio;
+	_rebuildCost = other._rebuildCost;
+	_optimizeCursor = other._optimizeCursor;
+	_counters = other._counters;
+	other.reset();
+
+	return *this;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::reset() {
+	_nodes = Indexer<Node>(0, _nodes.resource());
+	_data = Indexer<AABBTreeData<ValueType>>(0, _data.resource());
+	_root = nullindex;
+	_moveBuffer.clear();
+	_internalArea = 0;
+	_rebuildCost = 0;
+	_optimizeCursor = 0;
 }
 
 template<class ValueType, uint N, class KeyElementType>
 void AABBTree<ValueType, N, KeyElementType>::insertLeaf(index_t leafIdx) {
+	refit(attachLeaf(leafIdx));
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::removeLeaf(index_t leafIdx) {
+	refit(detachLeaf(leafIdx));
+}
+
+template<class ValueType, uint N, class KeyElementType>
+index_t AABBTree<ValueType, N, KeyElementType>::attachLeaf(index_t leafIdx) {
 	if (_root == nullindex) {
 		_root = leafIdx;
 		_nodes[leafIdx].parent = nullindex;
 
-		return;
+		return nullindex;
 	}
 
 	index_t siblingIdx = _root;
@@ -132,8 +478,8 @@ void AABBTree<ValueType, N, KeyElementType>::insertLeaf(index_t leafIdx) {
 
 	Node& newParent = _nodes[newParentIdx];
 	newParent.parent = oldParentIdx;
-	newParent.dataIdx = nullindex;
 	newParent.aabb = unite(leaf.aabb, sibling.aabb);
+	_internalArea += newParent.aabb.area();
 	newParent.height = sibling.height + 1;
 
 	if (oldParentIdx != nullindex) {
@@ -153,7 +499,11 @@ void AABBTree<ValueType, N, KeyElementType>::insertLeaf(index_t leafIdx) {
 	sibling.parent = newParentIdx;
 	leaf.parent = newParentIdx;
 
-	index_t idx = leaf.parent;
+	return newParentIdx;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::refit(index_t idx) {
 	while (idx != nullindex) {
 		idx = balance(idx);
 		Node& current = _nodes[idx];
@@ -162,17 +512,88 @@ void AABBTree<ValueType, N, KeyElementType>::insertLeaf(index_t leafIdx) {
 		Node& child2 = _nodes[current.child2];
 
 		current.height = 1 + (child1.height > child2.height ? child1.height : child2.height);
-		current.aabb = unite(child1.aabb, child2.aabb);
+		setInternalAABB(current, unite(child1.aabb, child2.aabb));
 
 		idx = current.parent;
 	}
 }
 
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::refit(std::span<const index_t> idxs) {
+	// Mark every node on the paths to the root, each ancestor only once. The mark lives in the height,
+	// which is recomputed below anyway, so no per-call buffer over all nodes is needed.
+	for (auto idx : idxs) {
+		while (idx != nullindex && _nodes.contains(idx) && _nodes[idx].height != REFIT_PENDING) {
+			_nodes[idx].height = REFIT_PENDING;
+			idx = _nodes[idx].parent;
+		}
+	}
+
+	if (_root == nullindex || _nodes[_root].height != REFIT_PENDING) {
+		return;
+	}
+
+	// Post-order over marked nodes so children are fixed before their parent. balance() reads heights
+	// of children and grandchildren only, which are all recomputed by then.
+	struct Visit {
+		index_t idx;
+		bool childrenDone;
+	};
+	GrowableStack<Visit, 256> stack;
+	stack.push(Visit{_root, false});
+	while (stack.count() > 0) {
+		const auto visit = stack.pop();
+		Node& node = _nodes[visit.idx];
+		if (node.isLeaf()) {
+			node.height = 0;
+			continue;
+		}
+
+		if (!visit.childrenDone) {
+			stack.push(Visit{visit.idx, true});
+			if (_nodes[node.child1].height == REFIT_PENDING) {
+				stack.push(Visit{node.child1, false});
+			}
+			if (_nodes[node.child2].height == REFIT_PENDING) {
+				stack.push(Visit{node.child2, false});
+			}
+			continue;
+		}
+
+		const auto idx = balance(visit.idx);
+		Node& current = _nodes[idx];
+
+		Node& child1 = _nodes[current.child1];
+		Node& child2 = _nodes[current.child2];
+
+		current.height = 1 + (child1.height > child2.height ? child1.height : child2.height);
+		setInternalAABB(current, unite(child1.aabb, child2.aabb));
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<std::ranges::input_range Range>
+AABBTree<ValueType, N, KeyElementType>::AABBTree(
+    const Range& range, KeyElementType aabbExtension, KeyElementType aabbMultiplier,
+    std::pmr::memory_resource* nodesResource, std::pmr::memory_resource* dataResource):
+    AABBTree(aabbExtension, aabbMultiplier, nodesResource, dataResource) {
+	build(std::ranges::begin(range), std::ranges::end(range));
+}
+
 template<class ValueType, uint N, class KeyElementType>
 template<class... Args>
 index_t AABBTree<ValueType, N, KeyElementType>::emplace(const AABBTree::AABB_t& aabb, Args&&... args) {
+	const auto leafIdx = createLeaf(aabb, std::forward<Args>(args)...);
+	insertLeaf(leafIdx);
+	rebuildIfDegraded();
+
+	return leafIdx;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<class... Args>
+index_t AABBTree<ValueType, N, KeyElementType>::createLeaf(const AABBTree::AABB_t& aabb, Args&&... args) {
 	const auto leafIdx = _nodes.create();
-	const auto dataIdx = _data.emplace(leafIdx, std::forward<Args>(args)...);
 
 	Node& leaf = _nodes[leafIdx];
 	if (_aabbExtension != KeyElementType{0}) {
@@ -181,15 +602,58 @@ index_t AABBTree<ValueType, N, KeyElementType>::emplace(const AABBTree::AABB_t&
 	} else {
 		leaf.aabb = aabb;
 	}
-	leaf.dataIdx = dataIdx;
+	leaf.child1 = leaf.parent = nullindex;
+	if constexpr (INLINE_VALUES) {
+		new (leaf.valueStorage) ValueType(std::forward<Args>(args)...);
+	} else {
+		// Node reference stays valid, data lives in another indexer
+		leaf.dataIdx = _data.emplace(leafIdx, std::forward<Args>(args)...);
+	}
 	leaf.height = 0;
-	leaf.child1 = leaf.child2 = leaf.parent = nullindex;
 
-	insertLeaf(leafIdx);
+	// The slot may still be in the move buffer from a removed leaf, duplicates are dropped on compaction
+	leaf.moveState = Node::MoveState::None;
+	bufferMove(leafIdx);
 
 	return leafIdx;
 }
 
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::bufferMove(index_t leafIdx) {
+	Node& leaf = _nodes[leafIdx];
+	if (leaf.moveState != Node::MoveState::None) {
+		return;
+	}
+	leaf.moveState = Node::MoveState::Buffered;
+
+	// Removed leaves are not erased from the buffer, keep it bounded by the number of leaves
+	if (_moveBuffer.size() >= 2 * count() + 64) {
+		compactMoveBuffer(Node::MoveState::Buffered);
+	}
+	_moveBuffer.push_back(leafIdx);
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::compactMoveBuffer(typename Node::MoveState state) {
+	// Live buffered leaves are marked with Collected state while compacting to skip duplicates
+	uint count = 0;
+	for (const auto idx : _moveBuffer) {
+		if (!_nodes.contains(idx)) {
+			continue;
+		}
+		Node& node = _nodes[idx];
+		if (node.isLeaf() && node.moveState == Node::MoveState::Buffered) {
+			node.moveState = Node::MoveState::Collected;
+			_moveBuffer[count++] = idx;
+		}
+	}
+	_moveBuffer.resize(count);
+
+	for (const auto idx : _moveBuffer) {
+		_nodes[idx].moveState = state;
+	}
+}
+
 template<class ValueType, uint N, class KeyElementType>
 index_t AABBTree<ValueType, N, KeyElementType>::balance(index_t iA) {
 	const auto max = [](uint a, uint b) { return a > b ? a : b; };
@@ -209,6 +673,8 @@ index_t AABBTree<ValueType, N, KeyElementType>::balance(index_t iA) {
 	                        Node& A, index_t iA, Node& C, index_t iC, Node& B, index_t iB) -> index_t {
 		const auto max = [](uint a, uint b) { return a > b ? a : b; };
 
+		this->_counters.rotations.add(1);
+
 		const auto iF = C.child1;
 		const auto iG = C.child2;
 		Node& F = _nodes[iF];
@@ -236,8 +702,8 @@ index_t AABBTree<ValueType, N, KeyElementType>::balance(index_t iA) {
 			C.child2 = iF;
 			A.child2 == iC ? A.child2 = iG : A.child1 = iG;
 			G.parent = iA;
-			A.aabb = unite(B.aabb, G.aabb);
-			C.aabb = unite(A.aabb, F.aabb);
+			this->setInternalAABB(A, unite(B.aabb, G.aabb));
+			this->setInternalAABB(C, unite(A.aabb, F.aabb));
 
 			A.height = 1 + max(B.height, G.height);
 			C.height = 1 + max(A.height, F.height);
@@ -245,8 +711,8 @@ index_t AABBTree<ValueType, N, KeyElementType>::balance(index_t iA) {
 			C.child2 = iG;
 			A.child2 == iC ? A.child2 = iF : A.child1 = iF;
 			F.parent = iA;
-			A.aabb = unite(B.aabb, F.aabb);
-			C.aabb = unite(A.aabb, G.aabb);
+			this->setInternalAABB(A, unite(B.aabb, F.aabb));
+			this->setInternalAABB(C, unite(A.aabb, G.aabb));
 
 			A.height = 1 + max(B.height, F.height);
 			C.height = 1 + max(A.height, G.height);
@@ -268,11 +734,11 @@ index_t AABBTree<ValueType, N, KeyElementType>::balance(index_t iA) {
 }
 
 template<class ValueType, uint N, class KeyElementType>
-void AABBTree<ValueType, N, KeyElementType>::removeLeaf(index_t leafIdx) {
+index_t AABBTree<ValueType, N, KeyElementType>::detachLeaf(index_t leafIdx) {
 	if (leafIdx == _root) {
 		_root = nullindex;
 
-		return;
+		return nullindex;
 	}
 	const auto parentIdx = _nodes[leafIdx].parent;
 	auto& parent = _nodes[parentIdx];
@@ -290,27 +756,15 @@ void AABBTree<ValueType, N, KeyElementType>::removeLeaf(index_t leafIdx) {
 			grandParent.child2 = siblingIdx;
 		}
 		sibling.parent = grandParentIdx;
-
-		// Adjust ancestor bounds.
-		auto currentIdx = grandParentIdx;
-		while (currentIdx != nullindex) {
-			currentIdx = balance(currentIdx);
-			auto& current = _nodes[currentIdx];
-
-			auto& child1 = _nodes[current.child1];
-			auto& child2 = _nodes[current.child2];
-
-			current.aabb = unite(child1.aabb, child2.aabb);
-			current.height = 1 + (child1.height > child2.height ? child1.height : child2.height);
-
-			currentIdx = current.parent;
-		}
 	} else {
 		_root = siblingIdx;
 		sibling.parent = nullindex;
 	}
 
+	_internalArea -= parent.aabb.area();
 	_nodes.remove(parentIdx);
+
+	return grandParentIdx;
 }
 
 template<class ValueType, uint N, class KeyElementType>
@@ -318,8 +772,11 @@ void AABBTree<ValueType, N, KeyElementType>::remove(index_t idx) {
 	assert(_nodes[idx].isLeaf());
 
 	removeLeaf(idx);
-	_data.remove(_nodes[idx].dataIdx);
+	if constexpr (!INLINE_VALUES) {
+		_data.remove(_nodes[idx].dataIdx);
+	}
 	_nodes.remove(idx);
+	rebuildIfDegraded();
 }
 
 template<class ValueType, uint N, class KeyElementType>
@@ -334,8 +791,91 @@ template<class ValueType, uint N, class KeyElementType>
 template<typename T>
 void AABBTree<ValueType, N, KeyElementType>::query(const AABBTree::AABB_t& aabb, const T& callback) const {
 	GrowableStack<index_t, 256> stack;
+	queryLeaves(aabb, [this, &callback](index_t leafIdx) { return callHit(callback, leafIdx); }, stack);
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<typename T>
+void AABBTree<ValueType, N, KeyElementType>::queryStackless(const AABBTree::AABB_t& aabb, const T& callback) const {
+	queryLeavesStackless(aabb, [this, &callback](index_t leafIdx) { return callHit(callback, leafIdx); });
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<typename T>
+bool AABBTree<ValueType, N, KeyElementType>::callHit(const T& callback, index_t leafIdx) const {
+	if constexpr (std::is_invocable_v<const T&, Handle>) {
+		return callback(Handle(leafIdx, leafValue(leafIdx)));
+	} else if constexpr (INLINE_VALUES) {
+		return callback(Iterator(this, leafIdx));
+	} else {
+		return callback(Iterator(_data.iteratorAt(_nodes[leafIdx].dataIdx)));
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<typename T>
+bool AABBTree<ValueType, N, KeyElementType>::queryLeavesStackless(
+    const AABBTree::AABB_t& aabb, const T& callback) const {
+	// The node we came from tells where to go next: from the parent - test the node and go down,
+	// from the first child - go to the second one, from the second child - go up.
+	index_t nodeIdx = _root;
+	index_t fromIdx = nullindex;
+	uint visited = 0;
+	uint leaves = 0;
+	while (nodeIdx != nullindex) {
+		const Node& node = _nodes[nodeIdx];
+		const auto prevIdx = fromIdx;
+		fromIdx = nodeIdx;
+
+		if (prevIdx == node.parent) {
+			++visited;
+			leaves += node.isLeaf();
+			if (node.aabb.isIntersecting(aabb)) {
+				if (!node.isLeaf()) {
+					nodeIdx = node.child1;
+					continue;
+				}
+				if (!callback(nodeIdx)) {
+					countQuery(visited, leaves);
+					return false;
+				}
+			}
+			nodeIdx = node.parent;
+		} else if (prevIdx == node.child1) {
+			nodeIdx = node.child2;
+		} else {
+			nodeIdx = node.parent;
+		}
+	}
+	countQuery(visited, leaves);
+
+	return true;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+uint AABBTree<ValueType, N, KeyElementType>::query(const AABBTree::AABB_t& aabb, std::vector<index_t>& hits) const {
+	const auto size = hits.size();
+	GrowableStack<index_t, 256> stack;
+	queryLeaves(
+	    aabb,
+	    [&hits](index_t leafIdx) {
+		    hits.push_back(leafIdx);
+		    return true;
+	    },
+	    stack);
+
+	return hits.size() - size;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<typename T>
+bool AABBTree<ValueType, N, KeyElementType>::queryLeaves(
+    const AABBTree::AABB_t& aabb, const T& callback, GrowableStack<index_t, 256>& stack) const {
+	stack.clear();
 	stack.push(_root);
 
+	uint visited = 0;
+	uint leaves = 0;
 	while (stack.count() > 0) {
 		index_t nodeIdx = stack.pop();
 		if (nodeIdx == nullindex) {
@@ -343,11 +883,14 @@ void AABBTree<ValueType, N, KeyElementType>::query(const AABBTree::AABB_t& aabb,
 		}
 
 		const Node& node = _nodes[nodeIdx];
+		++visited;
+		leaves += node.isLeaf();
 
 		if (node.aabb.isIntersecting(aabb)) {
 			if (node.isLeaf()) {
-				if (!callback(_data.begin() + node.dataIdx)) {
-					return;
+				if (!callback(nodeIdx)) {
+					countQuery(visited, leaves);
+					return false;
 				}
 			} else {
 				stack.push(node.child1);
@@ -355,82 +898,840 @@ void AABBTree<ValueType, N, KeyElementType>::query(const AABBTree::AABB_t& aabb,
 			}
 		}
 	}
+	countQuery(visited, leaves);
+
+	return true;
 }
 
 template<class ValueType, uint N, class KeyElementType>
-ValueType& AABBTree<ValueType, N, KeyElementType>::operator[](index_t idx) {
-	assert(_nodes[idx].isLeaf());
+template<typename T>
+bool AABBTree<ValueType, N, KeyElementType>::queryConvex(std::span<const Plane_t> planes, const T& callback) const {
+	static_assert(MAX_CONVEX_PLANES <= 32, "Planes are tracked in a 32 bit mask");
+	if (planes.size() > MAX_CONVEX_PLANES) {
+		return false;
+	}
+	if (_root == nullindex) {
+		return true;
+	}
+
+	// Bit i is set while plane i still has to be tested
+	struct Task {
+		index_t nodeIdx;
+		std::uint32_t planes;
+	};
+	GrowableStack<Task, 256> stack;
+	stack.push(Task{_root, planes.size() < 32 ? (std::uint32_t(1) << planes.size()) - 1 : ~std::uint32_t(0)});
+
+	uint visited = 0;
+	uint leaves = 0;
+	while (stack.count() > 0) {
+		auto task = stack.pop();
+		const Node& node = _nodes[task.nodeIdx];
+
+		if (task.planes) {
+			++visited;
+			leaves += node.isLeaf();
+		}
+
+		bool outside = false;
+		for (auto bits = task.planes; bits; bits &= bits - 1) {
+			const auto i = std::countr_zero(bits);
+			const auto& plane = planes[i];
+
+			// Extreme corners of the box along the normal
+			Real_t nearest = 0;
+			Real_t farthest = 0;
+			for (uint axis = 0; axis != N; ++axis) {
+				const auto n = plane.normal.point[axis];
+				const auto lb = n * Real_t(node.aabb.lb.point[axis]);
+				const auto ub = n * Real_t(node.aabb.ub.point[axis]);
+				nearest += lb < ub ? lb : ub;
+				farthest += lb < ub ? ub : lb;
+			}
+
+			if (nearest > plane.distance) {
+				outside = true;
+				break;
+			}
+			if (farthest <= plane.distance) {
+				task.planes &= ~(std::uint32_t(1) << i);
+			}
+		}
+		if (outside) {
+			continue;
+		}
+
+		if (node.isLeaf()) {
+			if (!callHit(callback, task.nodeIdx)) {
+				break;
+			}
+		} else {
+			stack.push(Task{node.child1, task.planes});
+			stack.push(Task{node.child2, task.planes});
+		}
+	}
+	countQuery(visited, leaves);
 
-	return _data[_nodes[idx].dataIdx].data;
+	return true;
 }
 
 template<class ValueType, uint N, class KeyElementType>
-const ValueType& AABBTree<ValueType, N, KeyElementType>::operator[](index_t idx) const {
-	assert(_nodes[idx].isLeaf());
-
-	return _data[_nodes[idx].dataIdx];
+void AABBTree<ValueType, N, KeyElementType>::countQuery(uint visited, uint leaves) const {
+	_counters.queries.add(1);
+	_counters.nodesVisited.add(visited);
+	_counters.leavesTested.add(leaves);
 }
 
 template<class ValueType, uint N, class KeyElementType>
-uint AABBTree<ValueType, N, KeyElementType>::count() const {
-	return _data.count();
+template<typename T, class Executor>
+void AABBTree<ValueType, N, KeyElementType>::queryBatch(
+    std::span<const AABB_t> boxes, const T& callback, Executor& executor) const {
+	// Traversal stacks are per worker and reused by all queries of that worker
+	const auto stacks = std::make_unique<GrowableStack<index_t, 256>[]>(executor.workersCount());
+
+	constexpr uint CHUNK_SIZE = 16;
+	executor.parallelFor(boxes.size(), CHUNK_SIZE, [this, &boxes, &callback, &stacks](uint worker, uint boxIdx) {
+		queryLeaves(
+		    boxes[boxIdx], [boxIdx, &callback](index_t leafIdx) { return callback(boxIdx, leafIdx); },
+		    stacks[worker]);
+	});
 }
 
 template<class ValueType, uint N, class KeyElementType>
-void AABBTree<ValueType, N, KeyElementType>::update(
-    index_t idx, const AABBTree::AABB_t& aabb, const typename AABB_t::Vec_t& displacement) {
-	AABB_t extAABB;
-	const typename AABB_t::Vec_t r(_aabbExtension);
-	if (_aabbExtension != KeyElementType{0}) {
-		extAABB.lb = aabb.lb - r;
-		extAABB.ub = aabb.ub + r;
-	} else {
-		extAABB = aabb;
+template<typename T>
+void AABBTree<ValueType, N, KeyElementType>::queryPairs(const T& callback) const {
+	if (_root == nullindex) {
+		return;
 	}
 
-	if (_aabbMultiplier != KeyElementType{0}) {
-		// Predict AABB movement
-		const typename AABB_t::Vec_t d = _aabbMultiplier * displacement;
+	// Descend the tree against itself. Pair (a, a) stands for all pairs inside subtree a,
+	// so every two leaves meet only once: in the pair of children of their lowest common ancestor.
+	struct NodePair {
+		index_t a;
+		index_t b;
+	};
+	GrowableStack<NodePair, 256> stack;
+	stack.push(NodePair{_root, _root});
 
-		for (uint i = 0; i != N; ++i) {
-			if (d.point[i] < KeyElementType{0}) {
-				extAABB.lb.point[i] += d.point[i];
-			} else {
-				extAABB.ub.point[i] += d.point[i];
+	while (stack.count() > 0) {
+		const auto pair = stack.pop();
+		const Node& a = _nodes[pair.a];
+
+		if (pair.a == pair.b) {
+			if (!a.isLeaf()) {
+				stack.push(NodePair{a.child1, a.child2});
+				stack.push(NodePair{a.child2, a.child2});
+				stack.push(NodePair{a.child1, a.child1});
+			}
+			continue;
+		}
+
+		const Node& b = _nodes[pair.b];
+		if (!a.aabb.isIntersecting(b.aabb)) {
+			continue;
+		}
+
+		if (a.isLeaf() && b.isLeaf()) {
+			if (!callback(pair.a, pair.b)) {
+				return;
 			}
+		} else if (b.isLeaf() || (!a.isLeaf() && a.aabb.area() >= b.aabb.area())) {
+			stack.push(NodePair{a.child2, pair.b});
+			stack.push(NodePair{a.child1, pair.b});
+		} else {
+			stack.push(NodePair{pair.a, b.child2});
+			stack.push(NodePair{pair.a, b.child1});
 		}
 	}
+}
 
-	const auto& treeAABB = _nodes[idx].aabb;
-	if (treeAABB.contains(aabb)) {
-		// The tree AABB still contains the object, but it might be too large.
-		// Perhaps the object was moving fast but has since gone to sleep.
-		// The huge AABB is larger than the new fat AABB.
-		AABB_t hugeAABB;
-		hugeAABB.lb = extAABB.lb - 4.0f * r;
-		hugeAABB.ub = extAABB.ub + 4.0f * r;
+template<class ValueType, uint N, class KeyElementType>
+template<typename T>
+void AABBTree<ValueType, N, KeyElementType>::queryMovedPairs(const T& callback) {
+	// After compaction every buffered leaf is unique, live and marked as Collected
+	compactMoveBuffer(Node::MoveState::Collected);
 
-		if (hugeAABB.contains(treeAABB)) {
-			// The tree AABB contains the object AABB and the tree AABB is
-			// not too large. No tree update needed.
-			return;
+	// One traversal stack for all moved leaves, it keeps storage it grew to
+	GrowableStack<index_t, 256> stack;
+	for (const auto movedIdx : _moveBuffer) {
+		const Node& moved = _nodes[movedIdx];
+
+		bool stop = false;
+		stack.clear();
+		stack.push(_root);
+		while (stack.count() > 0 && !stop) {
+			const auto nodeIdx = stack.pop();
+			const Node& node = _nodes[nodeIdx];
+			if (!node.aabb.isIntersecting(moved.aabb)) {
+				continue;
+			}
+
+			if (!node.isLeaf()) {
+				stack.push(node.child1);
+				stack.push(node.child2);
+				continue;
+			}
+
+			// When both leaves moved the pair is reported from the one with bigger index
+			if (nodeIdx == movedIdx || (node.moveState == Node::MoveState::Collected && nodeIdx > movedIdx)) {
+				continue;
+			}
+
+			stop = !callback(nodeIdx < movedIdx ? nodeIdx : movedIdx, nodeIdx < movedIdx ? movedIdx : nodeIdx);
 		}
 
-		// Otherwise the tree AABB is huge and needs to be shrunk
+		if (stop) {
+			break;
+		}
 	}
 
-	removeLeaf(idx);
-	_nodes[idx].aabb = extAABB;
-	insertLeaf(idx);
+	for (const auto idx : _moveBuffer) {
+		_nodes[idx].moveState = Node::MoveState::None;
+	}
+	_moveBuffer.clear();
 }
 
 template<class ValueType, uint N, class KeyElementType>
-template<class AABBType, class VecType>
-void AABBTree<ValueType, N, KeyElementType>::update(index_t idx, const AABBType& aabb, const VecType& displacement) {
-	AABBTree::AABB_t nAabb;
-	nAabb.set(aabb);
-	typename AABB_t::Vec_t nDisplacement;
-	nDisplacement.set(displacement);
+template<class Box>
+bool AABBTree<ValueType, N, KeyElementType>::raycast(
+    const Box& aabb, const Ray& ray, Real_t maxFraction, Real_t& fraction) {
+	Real_t tmin = 0;
+	Real_t tmax = maxFraction;
+	for (uint i = 0; i != N; ++i) {
+		const auto lb = Real_t(aabb.lb.point[i]);
+		const auto ub = Real_t(aabb.ub.point[i]);
+		if (ray.direction[i] == Real_t{0}) {
+			// Parallel to the slab
+			if (ray.origin[i] < lb || ray.origin[i] > ub) {
+				return false;
+			}
+			continue;
+		}
+
+		auto t1 = (lb - ray.origin[i]) * ray.invDirection[i];
+		auto t2 = (ub - ray.origin[i]) * ray.invDirection[i];
+		if (t1 > t2) {
+			std::swap(t1, t2);
+		}
+		tmin = t1 > tmin ? t1 : tmin;
+		tmax = t2 < tmax ? t2 : tmax;
+		if (tmin > tmax) {
+			return false;
+		}
+	}
+
+	fraction = tmin;
+
+	return true;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<class VecType, typename T>
+void AABBTree<ValueType, N, KeyElementType>::raycast(
+    const VecType& origin, const VecType& direction, Real_t maxFraction, const T& callback) const {
+	typename AABB_t::Vec_t nOrigin;
+	nOrigin.set(origin);
+	typename AABB_t::Vec_t nDirection;
+	nDirection.set(direction);
+	raycast(nOrigin, nDirection, maxFraction, callback);
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<typename T>
+void AABBTree<ValueType, N, KeyElementType>::raycast(const typename AABB_t::Vec_t& origin,
+    const typename AABB_t::Vec_t& direction, Real_t maxFraction, const T& callback) const {
+	if (_root == nullindex) {
+		return;
+	}
+
+	Ray ray;
+	for (uint i = 0; i != N; ++i) {
+		ray.origin[i] = Real_t(origin.point[i]);
+		ray.direction[i] = Real_t(direction.point[i]);
+		ray.invDirection[i] = ray.direction[i] != Real_t{0} ? Real_t{1} / ray.direction[i] : Real_t{0};
+	}
+
+	struct Entry {
+		index_t idx;
+		Real_t fraction;
+	};
+	GrowableStack<Entry, 256> stack;
+
+	Real_t fraction;
+	if (raycast(_nodes[_root].aabb, ray, maxFraction, fraction)) {
+		stack.push(Entry{_root, fraction});
+	}
+
+	while (stack.count() > 0) {
+		const auto entry = stack.pop();
+		// The segment could have been clipped after the node was pushed
+		if (entry.fraction > maxFraction) {
+			continue;
+		}
+
+		const Node& node = _nodes[entry.idx];
+		if (node.isLeaf()) {
+			const Real_t value = callback(entry.idx, entry.fraction);
+			if (value == Real_t{0}) {
+				return;
+			}
+			if (value > Real_t{0}) {
+				maxFraction = value < maxFraction ? value : maxFraction;
+			}
+			continue;
+		}
+
+		Real_t fraction1;
+		Real_t fraction2;
+		const bool hit1 = raycast(_nodes[node.child1].aabb, ray, maxFraction, fraction1);
+		const bool hit2 = raycast(_nodes[node.child2].aabb, ray, maxFraction, fraction2);
+
+		// Push the far child first so the near one is visited first
+		if (hit1 && hit2) {
+			if (fraction1 <= fraction2) {
+				stack.push(Entry{node.child2, fraction2});
+				stack.push(Entry{node.child1, fraction1});
+			} else {
+				stack.push(Entry{node.child1, fraction1});
+				stack.push(Entry{node.child2, fraction2});
+			}
+		} else if (hit1) {
+			stack.push(Entry{node.child1, fraction1});
+		} else if (hit2) {
+			stack.push(Entry{node.child2, fraction2});
+		}
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<typename T>
+void AABBTree<ValueType, N, KeyElementType>::nearest(
+    const typename AABB_t::Vec_t& point, uint k, const T& callback, Real_t maxDistance) const {
+	nearest(AABB_t{point, point}, k, callback, maxDistance);
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<typename T>
+void AABBTree<ValueType, N, KeyElementType>::nearest(
+    const AABB_t& aabb, uint k, const T& callback, Real_t maxDistance) const {
+	if (_root == nullindex || k == 0) {
+		return;
+	}
+
+	const auto maxSqDistance =
+	    maxDistance < std::sqrt(std::numeric_limits<Real_t>::max()) ? maxDistance * maxDistance : maxDistance;
+
+	// Best-first: distance to a node is a lower bound for its subtree, so leaves leave the queue
+	// in order and nothing farther than the k-th nearest leaf is ever expanded.
+	struct Entry {
+		Real_t sqDistance;
+		index_t idx;
+
+		bool operator>(const Entry& other) const { return sqDistance > other.sqDistance; }
+	};
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+	queue.push(Entry{_nodes[_root].aabb.template sqDistance<Real_t>(aabb), _root});
+
+	while (!queue.empty()) {
+		const auto entry = queue.top();
+		queue.pop();
+		if (entry.sqDistance > maxSqDistance) {
+			return;
+		}
+
+		const Node& node = _nodes[entry.idx];
+		if (node.isLeaf()) {
+			if (!callback(entry.idx, entry.sqDistance) || --k == 0) {
+				return;
+			}
+			continue;
+		}
+
+		for (const auto childIdx : {node.child1, node.child2}) {
+			const auto sqDistance = _nodes[childIdx].aabb.template sqDistance<Real_t>(aabb);
+			if (sqDistance <= maxSqDistance) {
+				queue.push(Entry{sqDistance, childIdx});
+			}
+		}
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+ValueType& AABBTree<ValueType, N, KeyElementType>::operator[](index_t idx) {
+	return leafValue(idx);
+}
+
+template<class ValueType, uint N, class KeyElementType>
+const ValueType& AABBTree<ValueType, N, KeyElementType>::operator[](index_t idx) const {
+	return leafValue(idx);
+}
+
+template<class ValueType, uint N, class KeyElementType>
+ValueType& AABBTree<ValueType, N, KeyElementType>::leafValue(index_t leafIdx) const {
+	// Values are user data, const tree still gives access to them same as Iterator does
+	auto& leaf = const_cast<Node&>(_nodes[leafIdx]);
+	assert(leaf.isLeaf());
+
+	if constexpr (INLINE_VALUES) {
+		return leaf.value();
+	} else {
+		return const_cast<ValueType&>(_data[leaf.dataIdx].data);
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+uint AABBTree<ValueType, N, KeyElementType>::count() const {
+	if constexpr (INLINE_VALUES) {
+		// Full binary tree over n leaves has n - 1 internal nodes
+		return _nodes.count() ? (_nodes.count() + 1) / 2 : 0;
+	} else {
+		return _data.count();
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+typename AABBTree<ValueType, N, KeyElementType>::Iterator AABBTree<ValueType, N, KeyElementType>::begin() const {
+	if constexpr (INLINE_VALUES) {
+		const auto first = _nodes.begin();
+		if (first == _nodes.end()) {
+			return end();
+		}
+
+		return Iterator(this, (*first).isLeaf() ? first.idx() : nextLeaf(first.idx()));
+	} else {
+		return Iterator(_data.begin());
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+typename AABBTree<ValueType, N, KeyElementType>::Iterator AABBTree<ValueType, N, KeyElementType>::end() const {
+	if constexpr (INLINE_VALUES) {
+		return Iterator(this, nullindex);
+	} else {
+		return Iterator(_data.end());
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+index_t AABBTree<ValueType, N, KeyElementType>::nextLeaf(index_t idx) const {
+	auto it = _nodes.iteratorAt(idx);
+	const auto end = _nodes.end();
+	for (++it; it != end; ++it) {
+		if ((*it).isLeaf()) {
+			return it.idx();
+		}
+	}
+
+	return nullindex;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+bool AABBTree<ValueType, N, KeyElementType>::reserve(uint nodesCount, uint objectsCount) {
+	if constexpr (INLINE_VALUES) {
+		return _nodes.reserve(nodesCount);
+	} else {
+		return _nodes.reserve(nodesCount) && _data.reserve(objectsCount);
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+bool AABBTree<ValueType, N, KeyElementType>::shrinkToFit() {
+	return _nodes.shrinkToFit() && _data.shrinkToFit();
+}
+
+template<class ValueType, uint N, class KeyElementType>
+std::vector<index_t> AABBTree<ValueType, N, KeyElementType>::compact(Layout layout) {
+	std::vector<index_t> remap(_nodes.capacity(), nullindex);
+
+	std::vector<index_t> order;
+	order.reserve(_nodes.count());
+	if (_root != nullindex) {
+		if (layout == Layout::VanEmdeBoas) {
+			vanEmdeBoasOrder(_root, _nodes[_root].height + 1, order);
+		} else {
+			GrowableStack<index_t, 256> stack;
+			stack.push(_root);
+			while (stack.count() > 0) {
+				const auto idx = stack.pop();
+				order.push_back(idx);
+
+				const Node& node = _nodes[idx];
+				if (!node.isLeaf()) {
+					stack.push(node.child2);
+					stack.push(node.child1);
+				}
+			}
+		}
+	}
+
+	// Stale and duplicate entries would not survive renumbering
+	compactMoveBuffer(Node::MoveState::Buffered);
+
+	// Fresh indexer hands out slots in index order
+	Indexer<Node> nodes(order.size(), _nodes.resource());
+	for (const auto idx : order) {
+		remap[idx] = nodes.create();
+	}
+	for (const auto idx : order) {
+		const Node& node = _nodes[idx];
+		Node& newNode = nodes[remap[idx]];
+		newNode = node;
+		newNode.parent = node.parent == nullindex ? nullindex : remap[node.parent];
+		if (node.isLeaf()) {
+			if constexpr (!INLINE_VALUES) {
+				_data[node.dataIdx].leafIdx = remap[idx];
+			}
+		} else {
+			newNode.child1 = remap[node.child1];
+			newNode.child2 = remap[node.child2];
+		}
+	}
+
+	_nodes = std::move(nodes);
+	_root = _root == nullindex ? nullindex : remap[_root];
+	for (auto& idx : _moveBuffer) {
+		idx = remap[idx];
+	}
+	_optimizeCursor = 0;
+
+	return remap;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+bool AABBTree<ValueType, N, KeyElementType>::save(std::ostream& stream) const {
+	static_assert(std::is_trivially_copyable_v<ValueType>, "Only trivially copyable values can be saved");
+
+	using Header = AABBTreeSnapshotHeader;
+	Header header{};
+	std::memcpy(header.magic, Header::MAGIC, sizeof(header.magic));
+	header.version = Header::VERSION;
+	header.byteOrder = Header::ENDIAN_TAG;
+	header.dimensions = N;
+	header.keySize = sizeof(KeyElementType);
+	header.indexSize = sizeof(index_t);
+	header.nodeSize = sizeof(Node);
+	header.valueSize = sizeof(ValueType);
+	constexpr auto floatingPoint = std::is_floating_point_v<KeyElementType>;
+	header.flags = (INLINE_VALUES ? std::uint32_t(Header::INLINE_VALUES) : std::uint32_t(0)) |
+	               (floatingPoint ? std::uint32_t(Header::FLOATING_POINT_KEY) : std::uint32_t(0));
+	header.root = _root;
+	header.count = count();
+	header.nodesCapacity = _nodes.capacity();
+	header.nodesOffset = Header::align(sizeof(Header));
+	header.valuesCapacity = INLINE_VALUES ? 0 : _data.capacity();
+	header.valuesOffset = Header::align(header.nodesOffset + header.nodesCapacity * sizeof(Node));
+	header.size = header.valuesOffset + header.valuesCapacity * sizeof(ValueType);
+
+	constexpr std::size_t SLOT_SIZE = sizeof(Node) > sizeof(ValueType) ? sizeof(Node) : sizeof(ValueType);
+	static constexpr char zeros[SLOT_SIZE > Header::ALIGNMENT ? SLOT_SIZE : Header::ALIGNMENT] = {};
+	const auto pad = [&stream](std::uint64_t offset) {
+		stream.write(zeros, Header::align(offset) - offset);
+	};
+
+	stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	pad(sizeof(header));
+	for (uint i = 0; i != header.nodesCapacity; ++i) {
+		if (_nodes.contains(i)) {
+			stream.write(reinterpret_cast<const char*>(&_nodes[i]), sizeof(Node));
+		} else {
+			stream.write(zeros, sizeof(Node));
+		}
+	}
+	pad(header.nodesOffset + header.nodesCapacity * sizeof(Node));
+	for (uint i = 0; i != header.valuesCapacity; ++i) {
+		if (_data.contains(i)) {
+			stream.write(reinterpret_cast<const char*>(&_data[i].data), sizeof(ValueType));
+		} else {
+			stream.write(zeros, sizeof(ValueType));
+		}
+	}
+
+	return bool(stream);
+}
+
+template<class ValueType, uint N, class KeyElementType>
+bool AABBTree<ValueType, N, KeyElementType>::save(const std::filesystem::path& path) const {
+	std::ofstream stream(path, std::ios::binary);
+
+	return save(stream) && bool(stream.flush());
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::vanEmdeBoasOrder(
+    index_t idx, uint depth, std::vector<index_t>& order) const {
+	if (depth == 1 || _nodes[idx].isLeaf()) {
+		order.push_back(idx);
+		return;
+	}
+
+	// Lay out the top half of levels, then every subtree hanging below it
+	const auto topDepth = depth / 2;
+	vanEmdeBoasOrder(idx, topDepth, order);
+
+	struct Entry {
+		index_t idx;
+		uint depth;
+	};
+	GrowableStack<Entry, 64> stack;
+	stack.push(Entry{idx, 0});
+	while (stack.count() > 0) {
+		const auto entry = stack.pop();
+		const Node& node = _nodes[entry.idx];
+		if (entry.depth == topDepth) {
+			vanEmdeBoasOrder(entry.idx, depth - topDepth, order);
+		} else if (!node.isLeaf()) {
+			stack.push(Entry{node.child2, entry.depth + 1});
+			stack.push(Entry{node.child1, entry.depth + 1});
+		}
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+bool AABBTree<ValueType, N, KeyElementType>::needsReinsert(
+    index_t idx, const AABB_t& aabb, const typename AABB_t::Vec_t& displacement, AABB_t& extAABB) const {
+	_counters.updates.add(1);
+
+	const typename AABB_t::Vec_t r(_aabbExtension);
+	if (_aabbExtension != KeyElementType{0}) {
+		extAABB.lb = aabb.lb - r;
+		extAABB.ub = aabb.ub + r;
+	} else {
+		extAABB = aabb;
+	}
+
+	if (_aabbMultiplier != KeyElementType{0}) {
+		// Predict AABB movement
+		const typename AABB_t::Vec_t d = _aabbMultiplier * displacement;
+
+		for (uint i = 0; i != N; ++i) {
+			if (d.point[i] < KeyElementType{0}) {
+				extAABB.lb.point[i] += d.point[i];
+			} else {
+				extAABB.ub.point[i] += d.point[i];
+			}
+		}
+	}
+
+	const auto& treeAABB = _nodes[idx].aabb;
+	if (treeAABB.contains(aabb)) {
+		// The tree AABB still contains the object, but it might be too large.
+		// Perhaps the object was moving fast but has since gone to sleep.
+		// The huge AABB is larger than the new fat AABB.
+		AABB_t hugeAABB;
+		hugeAABB.lb = extAABB.lb - KeyElementType(4) * r;
+		hugeAABB.ub = extAABB.ub + KeyElementType(4) * r;
+
+		if (hugeAABB.contains(treeAABB)) {
+			// The tree AABB contains the object AABB and the tree AABB is
+			// not too large. No tree update needed.
+			_counters.updatesKept.add(1);
+			return false;
+		}
+
+		// Otherwise the tree AABB is huge and needs to be shrunk
+	}
+
+	return true;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::update(
+    index_t idx, const AABBTree::AABB_t& aabb, const typename AABB_t::Vec_t& displacement) {
+	AABB_t extAABB;
+	if (!needsReinsert(idx, aabb, displacement, extAABB)) {
+		return;
+	}
+
+	removeLeaf(idx);
+	_nodes[idx].aabb = extAABB;
+	insertLeaf(idx);
+	bufferMove(idx);
+	rebuildIfDegraded();
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::updateMany(std::span<const index_t> idxs, std::span<const AABB_t> aabbs,
+    std::span<const typename AABB_t::Vec_t> displacements) {
+	assert(idxs.size() == aabbs.size());
+	assert(displacements.empty() || displacements.size() == idxs.size());
+
+	std::vector<index_t> dirty;
+	for (uint i = 0; i != idxs.size(); ++i) {
+		const auto idx = idxs[i];
+
+		AABB_t extAABB;
+		const auto displacement = displacements.empty() ? typename AABB_t::Vec_t(0) : displacements[i];
+		if (!needsReinsert(idx, aabbs[i], displacement, extAABB)) {
+			continue;
+		}
+
+		// Ancestors keep stale (too large or too small) bounds until the final refit,
+		// attachLeaf() only uses them as insertion cost estimation.
+		dirty.push_back(detachLeaf(idx));
+		_nodes[idx].aabb = extAABB;
+		dirty.push_back(attachLeaf(idx));
+		bufferMove(idx);
+	}
+
+	refit(dirty);
+	rebuildIfDegraded();
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::setInternalAABB(Node& node, const AABB_t& aabb) {
+	_internalArea += double(aabb.area()) - double(node.aabb.area());
+	node.aabb = aabb;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+typename AABBTree<ValueType, N, KeyElementType>::Real_t AABBTree<ValueType, N, KeyElementType>::cost() const {
+	if (_root == nullindex || _nodes[_root].isLeaf()) {
+		return 0;
+	}
+
+	const auto rootArea = double(_nodes[_root].aabb.area());
+
+	return rootArea > 0 ? Real_t(_internalArea / rootArea) : Real_t{0};
+}
+
+template<class ValueType, uint N, class KeyElementType>
+typename AABBTree<ValueType, N, KeyElementType>::Stats AABBTree<ValueType, N, KeyElementType>::stats() const {
+	Stats stats;
+	stats.height = _root == nullindex ? 0 : _nodes[_root].height;
+	stats.cost = cost();
+	stats.internalArea = Real_t(_internalArea);
+	stats.nodesCount = _nodes.count();
+	stats.nodesCapacity = _nodes.capacity();
+	stats.objectsCount = count();
+	stats.objectsCapacity = INLINE_VALUES ? 0 : _data.capacity();
+
+	stats.queries = _counters.queries.value();
+	stats.nodesVisited = _counters.nodesVisited.value();
+	stats.leavesTested = _counters.leavesTested.value();
+	stats.rotations = _counters.rotations.value();
+	stats.updates = _counters.updates.value();
+	stats.updatesKept = _counters.updatesKept.value();
+
+	return stats;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::resetStats() {
+	_counters.queries.reset();
+	_counters.nodesVisited.reset();
+	_counters.leavesTested.reset();
+	_counters.rotations.reset();
+	_counters.updates.reset();
+	_counters.updatesKept.reset();
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::setRebuildRatio(Real_t ratio) {
+	_rebuildRatio = ratio;
+	_rebuildCost = cost();
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::rebuildIfDegraded() {
+	if (_rebuildRatio == Real_t{0}) {
+		return;
+	}
+
+	const auto current = cost();
+	if (_rebuildCost == Real_t{0}) {
+		// Tree had less than two leaves, take the first real cost as the reference
+		_rebuildCost = current;
+	} else if (current > _rebuildRatio * _rebuildCost) {
+		rebuild();
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+uint AABBTree<ValueType, N, KeyElementType>::optimize(uint budget) {
+	// Subtree of height h has at most 2^h leaves
+	uint maxHeight = 0;
+	while (maxHeight + 1 < 64 && (uint(1) << (maxHeight + 1)) <= budget) {
+		++maxHeight;
+	}
+	if (maxHeight < 2) {
+		return 0;
+	}
+
+	// Walk over node slots looking for the highest subtrees that fit, at most one full round per call
+	const auto capacity = _nodes.capacity();
+	uint rebuilt = 0;
+	for (uint i = 0; i != capacity && rebuilt + (uint(1) << maxHeight) <= budget; ++i) {
+		if (_optimizeCursor >= capacity) {
+			_optimizeCursor = 0;
+		}
+		const auto idx = _optimizeCursor++;
+		if (!_nodes.contains(idx)) {
+			continue;
+		}
+
+		const Node& node = _nodes[idx];
+		if (node.isLeaf() || node.height > maxHeight ||
+		    (node.parent != nullindex && _nodes[node.parent].height <= maxHeight)) {
+			continue;
+		}
+
+		rebuilt += rebuildSubtree(idx);
+	}
+
+	return rebuilt;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+uint AABBTree<ValueType, N, KeyElementType>::rebuildSubtree(index_t idx) {
+	std::vector<BuildItem> items;
+	std::vector<index_t> internal;
+
+	GrowableStack<index_t, 256> stack;
+	stack.push(idx);
+	while (stack.count() > 0) {
+		const auto nodeIdx = stack.pop();
+		const Node& node = _nodes[nodeIdx];
+		if (node.isLeaf()) {
+			items.emplace_back().leafIdx = nodeIdx;
+		} else {
+			stack.push(node.child1);
+			stack.push(node.child2);
+			internal.push_back(nodeIdx);
+			_internalArea -= node.aabb.area();
+		}
+	}
+	if (internal.empty()) {
+		return items.size();
+	}
+
+	fillItems(items.data(), items.size());
+	const auto parentIdx = _nodes[idx].parent;
+	const auto root = buildSubtree(items.data(), items.size(), internal.data(), _internalArea);
+	_nodes[root].parent = parentIdx;
+	if (parentIdx == nullindex) {
+		_root = root;
+		return items.size();
+	}
+
+	Node& parent = _nodes[parentIdx];
+	(parent.child1 == idx ? parent.child1 : parent.child2) = root;
+	for (auto i = parentIdx; i != nullindex; i = _nodes[i].parent) {
+		Node& node = _nodes[i];
+		const auto& child1 = _nodes[node.child1];
+		const auto& child2 = _nodes[node.child2];
+		node.height = 1 + (child1.height > child2.height ? child1.height : child2.height);
+	}
+
+	return items.size();
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<class AABBType, class VecType>
+void AABBTree<ValueType, N, KeyElementType>::update(index_t idx, const AABBType& aabb, const VecType& displacement) {
+	AABBTree::AABB_t nAabb;
+	nAabb.set(aabb);
+	typename AABB_t::Vec_t nDisplacement;
+	nDisplacement.set(displacement);
 	update(idx, nAabb, nDisplacement);
 }
 
@@ -442,4 +1743,383 @@ index_t AABBTree<ValueType, N, KeyElementType>::emplace(const AABBType& aabb, Ar
 
 	return emplace(nAabb, std::forward<Args>(args)...);
 }
+template<class ValueType, uint N, class KeyElementType>
+template<std::input_iterator InputIt>
+void AABBTree<ValueType, N, KeyElementType>::build(InputIt first, InputIt last) {
+	struct NullOutput {
+		auto& operator*() { return *this; }
+		auto& operator++() { return *this; }
+		auto& operator=(index_t) { return *this; }
+	};
+
+	build(first, last, NullOutput{});
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<std::input_iterator InputIt, class OutputIt>
+OutputIt AABBTree<ValueType, N, KeyElementType>::build(InputIt first, InputIt last, OutputIt idxs) {
+	std::vector<BuildItem> items;
+	collectLeaves(items);
+	idxs = createLeaves(first, last, idxs, items);
+	buildItems(items);
+
+	return idxs;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<std::input_iterator InputIt, class OutputIt, class Executor>
+OutputIt AABBTree<ValueType, N, KeyElementType>::build(
+    InputIt first, InputIt last, OutputIt idxs, Executor& executor) {
+	std::vector<BuildItem> items;
+	collectLeaves(items);
+	idxs = createLeaves(first, last, idxs, items);
+	buildItems(items, executor);
+
+	return idxs;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<std::input_iterator InputIt, class OutputIt>
+OutputIt AABBTree<ValueType, N, KeyElementType>::createLeaves(
+    InputIt first, InputIt last, OutputIt idxs, std::vector<BuildItem>& items) {
+	if constexpr (std::forward_iterator<InputIt>) {
+		const auto count = static_cast<uint>(std::distance(first, last));
+		_nodes.reserve(2 * (items.size() + count));
+		if constexpr (!INLINE_VALUES) {
+			_data.reserve(_data.count() + count);
+		}
+		items.reserve(items.size() + count);
+	}
+
+	for (; first != last; ++first) {
+		const auto& [aabb, value] = *first;
+
+		index_t leafIdx;
+		if constexpr (std::is_same_v<std::decay_t<decltype(aabb)>, AABB_t>) {
+			leafIdx = createLeaf(aabb, value);
+		} else {
+			leafIdx = createLeaf(AABB_t().set(aabb), value);
+		}
+		items.emplace_back().leafIdx = leafIdx;
+		*idxs = leafIdx;
+		++idxs;
+	}
+
+	return idxs;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::rebuild() {
+	std::vector<BuildItem> items;
+	collectLeaves(items);
+	buildItems(items);
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<class Executor>
+void AABBTree<ValueType, N, KeyElementType>::rebuild(Executor& executor) {
+	std::vector<BuildItem> items;
+	collectLeaves(items);
+	buildItems(items, executor);
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::collectLeaves(std::vector<BuildItem>& items) {
+	items.reserve(items.size() + count());
+	if (_root == nullindex) {
+		return;
+	}
+
+	GrowableStack<index_t, 256> stack;
+	stack.push(_root);
+	while (stack.count() > 0) {
+		const auto nodeIdx = stack.pop();
+		const Node& node = _nodes[nodeIdx];
+		if (node.isLeaf()) {
+			items.emplace_back().leafIdx = nodeIdx;
+		} else {
+			stack.push(node.child1);
+			stack.push(node.child2);
+			_nodes.remove(nodeIdx);
+		}
+	}
+	_root = nullindex;
+	_internalArea = 0;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::fillItems(BuildItem* items, uint count) const {
+	for (uint i = 0; i != count; ++i) {
+		auto& item = items[i];
+		item.aabb = _nodes[item.leafIdx].aabb;
+		for (uint axis = 0; axis != N; ++axis) {
+			item.centroid[axis] = Real_t(item.aabb.lb.point[axis]) + Real_t(item.aabb.ub.point[axis]);
+		}
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTree<ValueType, N, KeyElementType>::buildItems(std::vector<BuildItem>& items) {
+	if (items.empty()) {
+		return;
+	}
+
+	fillItems(items.data(), items.size());
+	std::vector<index_t> internal;
+	internal.reserve(items.size() - 1);
+	for (uint i = 0; i + 1 < items.size(); ++i) {
+		internal.push_back(_nodes.create());
+	}
+
+	_root = buildSubtree(items.data(), items.size(), internal.data(), _internalArea);
+	_rebuildCost = cost();
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<class Executor>
+void AABBTree<ValueType, N, KeyElementType>::buildItems(std::vector<BuildItem>& items, Executor& executor) {
+	if (items.empty()) {
+		return;
+	}
+
+	constexpr uint CHUNK_SIZE = 1024;
+	const uint count = items.size();
+	executor.parallelFor((count + CHUNK_SIZE - 1) / CHUNK_SIZE, 1, [this, &items, count](uint, uint chunk) {
+		const auto begin = chunk * CHUNK_SIZE;
+		fillItems(items.data() + begin, begin + CHUNK_SIZE < count ? CHUNK_SIZE : count - begin);
+	});
+
+	std::vector<index_t> internal;
+	internal.reserve(count - 1);
+	for (uint i = 0; i + 1 < count; ++i) {
+		internal.push_back(_nodes.create());
+	}
+
+	struct Task {
+		uint begin;
+		uint end;
+		index_t parent;
+		bool second; // child2 of parent
+	};
+
+	// Large ranges are split level by level, all ranges of a level at once. Splits and slots are the same
+	// as of buildSubtree(), so is the result. Created nodes are kept in level order, parents before children.
+	std::vector<Task> level;
+	std::vector<Task> next;
+	std::vector<Task> subtrees;
+	(count > PARALLEL_BUILD_GRAIN ? level : subtrees).push_back(Task{0, count, nullindex, false});
+	std::vector<uint> splits;
+	std::vector<index_t> created;
+	while (!level.empty()) {
+		splits.resize(level.size());
+		executor.parallelFor(level.size(), 1, [this, &items, &level, &splits](uint, uint i) {
+			const auto& task = level[i];
+			splits[i] = task.begin + findSplit(items.data() + task.begin, task.end - task.begin);
+		});
+
+		next.clear();
+		for (uint i = 0; i != level.size(); ++i) {
+			const auto& task = level[i];
+			const auto nodeIdx = internal[splits[i] - 1];
+			created.push_back(nodeIdx);
+
+			Node& node = _nodes[nodeIdx];
+			node.parent = task.parent;
+			if (task.parent == nullindex) {
+				_root = nodeIdx;
+			} else {
+				Node& parent = _nodes[task.parent];
+				(task.second ? parent.child2 : parent.child1) = nodeIdx;
+			}
+
+			const Task children[] = {Task{task.begin, splits[i], nodeIdx, false}, Task{splits[i], task.end, nodeIdx, true}};
+			for (const auto& child : children) {
+				(child.end - child.begin > PARALLEL_BUILD_GRAIN ? next : subtrees).push_back(child);
+			}
+		}
+		std::swap(level, next);
+	}
+
+	std::vector<index_t> roots(subtrees.size());
+	std::vector<double> areas(subtrees.size());
+	executor.parallelFor(subtrees.size(), 1, [this, &items, &internal, &subtrees, &roots, &areas](uint, uint i) {
+		const auto& task = subtrees[i];
+		roots[i] = buildSubtree(
+		    items.data() + task.begin, task.end - task.begin, internal.data() + task.begin, areas[i]);
+	});
+
+	// Summed in fixed order, cost() doesn't depend on workers count either
+	for (uint i = 0; i != subtrees.size(); ++i) {
+		const auto& task = subtrees[i];
+		_nodes[roots[i]].parent = task.parent;
+		if (task.parent == nullindex) {
+			_root = roots[i];
+		} else {
+			Node& parent = _nodes[task.parent];
+			(task.second ? parent.child2 : parent.child1) = roots[i];
+		}
+		_internalArea += areas[i];
+	}
+
+	for (auto it = created.rbegin(); it != created.rend(); ++it) {
+		Node& node = _nodes[*it];
+		const Node& child1 = _nodes[node.child1];
+		const Node& child2 = _nodes[node.child2];
+
+		node.aabb = unite(child1.aabb, child2.aabb);
+		node.height = 1 + (child1.height > child2.height ? child1.height : child2.height);
+		_internalArea += node.aabb.area();
+	}
+
+	_rebuildCost = cost();
+}
+
+template<class ValueType, uint N, class KeyElementType>
+index_t AABBTree<ValueType, N, KeyElementType>::buildSubtree(
+    BuildItem* items, uint count, const index_t* internal, double& internalArea) {
+	struct Task {
+		uint begin;
+		uint end;
+		index_t parent;
+	};
+
+	// Internal node over items [begin, end) split at s takes slot internal[s - 1],
+	// so every node gets a unique slot no matter in which order subtrees are built.
+	// Tasks are taken in preorder, reverse of it gives children before parents for heights update.
+	std::vector<index_t> preorder;
+	preorder.reserve(count - 1);
+
+	index_t root = nullindex;
+	GrowableStack<Task, 64> stack;
+	stack.push(Task{0, count, nullindex});
+	while (stack.count() > 0) {
+		const auto task = stack.pop();
+
+		index_t nodeIdx;
+		if (task.end - task.begin == 1) {
+			nodeIdx = items[task.begin].leafIdx;
+		} else {
+			const auto split = task.begin + findSplit(items + task.begin, task.end - task.begin);
+			nodeIdx = internal[split - 1];
+			preorder.push_back(nodeIdx);
+
+			Node& node = _nodes[nodeIdx];
+			node.child1 = node.child2 = nullindex;
+
+			stack.push(Task{split, task.end, nodeIdx});
+			stack.push(Task{task.begin, split, nodeIdx});
+		}
+
+		_nodes[nodeIdx].parent = task.parent;
+		if (task.parent == nullindex) {
+			root = nodeIdx;
+		} else {
+			Node& parent = _nodes[task.parent];
+			// Left subtree is always taken first
+			if (parent.child1 == nullindex) {
+				parent.child1 = nodeIdx;
+			} else {
+				parent.child2 = nodeIdx;
+			}
+		}
+	}
+
+	for (auto it = preorder.rbegin(); it != preorder.rend(); ++it) {
+		Node& node = _nodes[*it];
+		const Node& child1 = _nodes[node.child1];
+		const Node& child2 = _nodes[node.child2];
+
+		node.aabb = unite(child1.aabb, child2.aabb);
+		node.height = 1 + (child1.height > child2.height ? child1.height : child2.height);
+		internalArea += node.aabb.area();
+	}
+
+	return root;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+uint AABBTree<ValueType, N, KeyElementType>::findSplit(BuildItem* items, uint count) {
+	if (count == 2) {
+		return 1;
+	}
+
+	Real_t cmin[N];
+	Real_t cmax[N];
+	for (uint axis = 0; axis != N; ++axis) {
+		cmin[axis] = cmax[axis] = items[0].centroid[axis];
+	}
+	for (uint i = 1; i != count; ++i) {
+		for (uint axis = 0; axis != N; ++axis) {
+			const auto c = items[i].centroid[axis];
+			cmin[axis] = c < cmin[axis] ? c : cmin[axis];
+			cmax[axis] = c > cmax[axis] ? c : cmax[axis];
+		}
+	}
+
+	// Bin along the axis with the widest centroid spread only
+	uint axis = 0;
+	for (uint i = 1; i != N; ++i) {
+		if (cmax[i] - cmin[i] > cmax[axis] - cmin[axis]) {
+			axis = i;
+		}
+	}
+	if (!(cmax[axis] > cmin[axis])) {
+		// All centroids are the same, any split is as good as another
+		return count / 2;
+	}
+
+	const auto scale = Real_t(BUILD_BINS_COUNT) / (cmax[axis] - cmin[axis]);
+	const auto binOf = [axis, scale, min = cmin[axis]](const BuildItem& item) {
+		const auto bin = static_cast<uint>((item.centroid[axis] - min) * scale);
+		return bin < BUILD_BINS_COUNT ? bin : BUILD_BINS_COUNT - 1;
+	};
+
+	AABB_t bounds[BUILD_BINS_COUNT];
+	uint counts[BUILD_BINS_COUNT] = {};
+	for (uint i = 0; i != count; ++i) {
+		const auto bin = binOf(items[i]);
+		if (counts[bin]++) {
+			bounds[bin].unite(items[i].aabb);
+		} else {
+			bounds[bin] = items[i].aabb;
+		}
+	}
+
+	// Sweep from the right to get cost of all right parts, then from the left.
+	// Lowest and highest centroids fall into the first and the last bins, so there is always a split.
+	Real_t rightCost[BUILD_BINS_COUNT];
+	AABB_t right;
+	uint rightCount = 0;
+	for (uint bin = BUILD_BINS_COUNT - 1; bin != 0; --bin) {
+		if (counts[bin]) {
+			right = rightCount ? right.unite(bounds[bin]) : bounds[bin];
+			rightCount += counts[bin];
+		}
+		rightCost[bin] = rightCount ? Real_t(right.area()) * rightCount : 0;
+	}
+
+	uint bestBin = 0;
+	Real_t bestCost = 0;
+	AABB_t left;
+	uint leftCount = 0;
+	for (uint bin = 0; bin != BUILD_BINS_COUNT - 1; ++bin) {
+		if (!counts[bin]) {
+			continue;
+		}
+		left = leftCount ? left.unite(bounds[bin]) : bounds[bin];
+		leftCount += counts[bin];
+
+		const auto cost = Real_t(left.area()) * leftCount + rightCost[bin + 1];
+		if (leftCount == counts[bin] || cost < bestCost) {
+			bestBin = bin;
+			bestCost = cost;
+		}
+	}
+
+	const auto middle =
+	    std::partition(items, items + count, [&](const BuildItem& item) { return binOf(item) <= bestBin; });
+
+	return middle - items;
+}
+
 } // namespace biss
\ No newline at end of file
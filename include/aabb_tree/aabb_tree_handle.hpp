@@ -0,0 +1,25 @@
+#pragma once
+
+#include "typedefs.hpp"
+
+namespace biss {
+
+// Hit passed to query() callbacks: leaf index and a reference to its value.
+// Converts to index_t, so it can be stored or passed to AABBTree::operator[], update() and remove().
+template<class ValueType>
+class AABBTreeHandle {
+  public:
+	AABBTreeHandle(index_t idx, ValueType& value): _idx(idx), _value(&value) {}
+
+	ValueType& operator*() const { return *_value; }
+	ValueType* operator->() const { return _value; }
+
+	index_t idx() const { return _idx; }
+	operator index_t() const { return _idx; }
+
+  private:
+	index_t _idx;
+	ValueType* _value;
+};
+
+} // namespace biss
\ No newline at end of file
@@ -25,4 +25,33 @@ class AABBTreeIterator {
 	typename Indexer<AABBTreeData<ValueType>>::Iterator _it;
 };
 
+// Iterator over leaves of a tree that stores values in leaf nodes (AABBTree::INLINE_VALUES)
+template<class Tree, class ValueType>
+class AABBTreeLeafIterator {
+  public:
+	AABBTreeLeafIterator(const Tree* tree, index_t idx): _tree(tree), _idx(idx) {}
+
+	ValueType& operator*() const { return _tree->leafValue(_idx); }
+	ValueType* operator->() const { return &_tree->leafValue(_idx); }
+
+	auto& operator++() {
+		_idx = _tree->nextLeaf(_idx);
+		return *this;
+	}
+	auto operator++(int) {
+		auto copy = *this;
+		_idx = _tree->nextLeaf(_idx);
+		return copy;
+	}
+
+	bool operator==(const AABBTreeLeafIterator& other) const { return _idx == other._idx; }
+	bool operator!=(const AABBTreeLeafIterator& other) const { return _idx != other._idx; }
+
+	index_t idx() const { return _idx; }
+
+  private:
+	const Tree* _tree;
+	index_t _idx;
+};
+
 } // namespace biss
\ No newline at end of file
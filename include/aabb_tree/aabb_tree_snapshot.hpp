@@ -0,0 +1,44 @@
+#pragma once
+
+#include "typedefs.hpp"
+
+#include <cstdint>
+
+namespace biss {
+
+// Header of files written by AABBTree::save() and read by AABBTreeView.
+// Arrays follow the header at 64 byte aligned offsets: node slots, then value slots (none with inline values).
+// Both are raw memory images, free slots are zeroed.
+struct AABBTreeSnapshotHeader {
+	static constexpr char MAGIC[8] = {'B', 'I', 'S', 'S', 'A', 'A', 'B', 'B'};
+	static constexpr std::uint32_t VERSION = 1;
+	// Written in native byte order, reads back differently on a machine with other endianness
+	static constexpr std::uint32_t ENDIAN_TAG = 0x01020304;
+	static constexpr std::uint64_t ALIGNMENT = 64;
+
+	enum Flags : std::uint32_t { INLINE_VALUES = 1, FLOATING_POINT_KEY = 2 };
+
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t byteOrder;
+
+	// Layout of the tree type that wrote the file, must match the reader exactly
+	std::uint32_t dimensions;
+	std::uint32_t keySize;
+	std::uint32_t indexSize;
+	std::uint32_t nodeSize;
+	std::uint32_t valueSize;
+	std::uint32_t flags;
+
+	std::uint64_t root;
+	std::uint64_t count;
+	std::uint64_t nodesCapacity;
+	std::uint64_t nodesOffset;
+	std::uint64_t valuesCapacity;
+	std::uint64_t valuesOffset;
+	std::uint64_t size;
+
+	static constexpr std::uint64_t align(std::uint64_t offset) { return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; }
+};
+
+} // namespace biss
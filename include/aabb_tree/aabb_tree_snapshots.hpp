@@ -0,0 +1,62 @@
+#pragma once
+
+#include "aabb_tree.hpp"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace biss {
+
+// Immutable copies of a tree published by one writer thread to any number of reader threads.
+// The writer keeps changing its own tree and calls publish() once a frame, readers acquire() the last published
+// snapshot and query it for as long as they hold it. The writer never waits for readers to finish with old
+// snapshots and queries of a snapshot take no locks. publish() and acquire() swap a std::atomic<std::shared_ptr>,
+// which is not lock-free in common standard libraries: they may briefly contend on its internal lock.
+// Snapshots are reclaimed when the last reader drops them and their storage is reused by later publish() calls,
+// so publishing in steady state is a copy of node and object arrays without allocations.
+// Tree is AABBTree or any copy-assignable tree type.
+template<class Tree>
+class AABBTreeSnapshots {
+  public:
+	using Snapshot = std::shared_ptr<const Tree>;
+
+	// Writer thread only
+	void publish(const Tree& tree);
+
+	// Last published snapshot, nullptr before the first publish()
+	Snapshot acquire() const { return _current.load(std::memory_order_acquire); }
+
+	// Snapshots allocated so far, current and retired ones
+	uint buffersCount() const { return _buffers.size(); }
+
+  private:
+	std::atomic<std::shared_ptr<const Tree>> _current;
+	// All snapshots, a snapshot nobody else refers to can be overwritten
+	std::vector<std::shared_ptr<Tree>> _buffers;
+};
+
+template<class Tree>
+void AABBTreeSnapshots<Tree>::publish(const Tree& tree) {
+	std::shared_ptr<Tree> buffer;
+	for (const auto& retired : _buffers) {
+		// Neither current nor held by readers, and can't be acquired again
+		if (retired.use_count() == 1) {
+			// Pairs with the release of the last reference, reads of the last reader happen before the copy
+			std::atomic_thread_fence(std::memory_order_acquire);
+			buffer = retired;
+			break;
+		}
+	}
+
+	if (buffer) {
+		*buffer = tree;
+	} else {
+		buffer = std::make_shared<Tree>(tree);
+		_buffers.push_back(buffer);
+	}
+
+	_current.store(std::move(buffer), std::memory_order_release);
+}
+
+} // namespace biss
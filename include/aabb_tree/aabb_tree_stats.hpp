@@ -0,0 +1,80 @@
+#pragma once
+
+#include "typedefs.hpp"
+
+#include <atomic>
+#include <cstdint>
+
+namespace biss {
+
+// Returned by AABBTree::stats()
+template<class Real>
+struct AABBTreeStats {
+	// Shape, always available
+	uint height = 0;       // nodes on the longest path from the root to a leaf minus one
+	Real cost = 0;         // SAH cost relative to the root area, see AABBTree::cost()
+	Real internalArea = 0; // total area of internal nodes
+	uint nodesCount = 0;
+	uint nodesCapacity = 0;
+	uint objectsCount = 0;
+	uint objectsCapacity = 0; // 0 with inline values
+
+	// Counted since construction or resetStats(), zero unless AABB_TREE_STATS is 1
+	std::uint64_t queries = 0;      // box queries, one per box of queryBatch()
+	std::uint64_t nodesVisited = 0; // nodes tested against query boxes
+	std::uint64_t leavesTested = 0; // leaves among them
+	std::uint64_t rotations = 0;    // by balance()
+	std::uint64_t updates = 0;      // objects passed to update() and updateMany()
+	std::uint64_t updatesKept = 0;  // of them kept their fat AABB and skipped reinsertion
+
+	Real nodesVisitedPerQuery() const { return queries ? Real(nodesVisited) / queries : Real{0}; }
+	Real leavesTestedPerQuery() const { return queries ? Real(leavesTested) / queries : Real{0}; }
+	Real fatAABBHitRate() const { return updates ? Real(updatesKept) / updates : Real{0}; }
+};
+
+// Relaxed atomic, const queries running concurrently may count
+class AABBTreeCounter {
+  public:
+	AABBTreeCounter() = default;
+	AABBTreeCounter(const AABBTreeCounter& other): _value(other.value()) {}
+	AABBTreeCounter& operator=(const AABBTreeCounter& other) {
+		_value.store(other.value(), std::memory_order_relaxed);
+		return *this;
+	}
+
+	void add(std::uint64_t n) const { _value.fetch_add(n, std::memory_order_relaxed); }
+	std::uint64_t value() const { return _value.load(std::memory_order_relaxed); }
+	void reset() const { _value.store(0, std::memory_order_relaxed); }
+
+  private:
+	mutable std::atomic<std::uint64_t> _value = 0;
+};
+
+template<bool Enabled>
+struct AABBTreeCounters {
+	AABBTreeCounter queries;
+	AABBTreeCounter nodesVisited;
+	AABBTreeCounter leavesTested;
+	AABBTreeCounter rotations;
+	AABBTreeCounter updates;
+	AABBTreeCounter updatesKept;
+};
+
+// Empty, counting compiles to nothing
+template<>
+struct AABBTreeCounters<false> {
+	struct Counter {
+		void add(std::uint64_t) const {}
+		std::uint64_t value() const { return 0; }
+		void reset() const {}
+	};
+
+	static constexpr Counter queries{};
+	static constexpr Counter nodesVisited{};
+	static constexpr Counter leavesTested{};
+	static constexpr Counter rotations{};
+	static constexpr Counter updates{};
+	static constexpr Counter updatesKept{};
+};
+
+} // namespace biss
\ No newline at end of file
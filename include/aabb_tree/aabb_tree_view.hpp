@@ -0,0 +1,340 @@
+#pragma once
+
+#include "aabb_tree.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace biss {
+
+// Read-only tree over a snapshot written by AABBTree::save(). Nodes and values are used right where they lie,
+// so opening a memory mapped file costs no parsing or copying, pages are loaded as queries touch them.
+// Queries check no indices, see Validate for files that may be corrupt.
+// Reported indices are leaf indices of the saved tree.
+template<class ValueType, uint N, class KeyElementType>
+class AABBTreeView {
+  public:
+	using Tree = AABBTree<ValueType, N, KeyElementType>;
+	using AABB_t = typename Tree::AABB_t;
+	using Handle = AABBTreeHandle<const ValueType>;
+
+	enum class Validate {
+		Header, // type, sizes and offsets, O(1)
+		Full    // also walk the whole hierarchy, reads every node once (all pages of a mapped file)
+	};
+
+	AABBTreeView() = default;
+	~AABBTreeView();
+
+	AABBTreeView(const AABBTreeView& other) = delete;
+	AABBTreeView(AABBTreeView&& other) noexcept;
+	AABBTreeView& operator=(AABBTreeView&& other) noexcept;
+
+	// View snapshot at data, memory must stay valid while the view is open.
+	// Returns false if it is not a snapshot of this tree type, or with Validate::Full if it is not a valid tree.
+	bool open(const void* data, std::size_t size, Validate validate = Validate::Header);
+	// Map file into memory (read into memory where mmap is not available)
+	bool open(const std::filesystem::path& path, Validate validate = Validate::Header);
+	void close();
+
+	bool isOpen() const { return _header != nullptr; }
+
+	// callback(Handle) -> bool is called for every leaf intersecting aabb, return false to stop
+	template<typename T>
+	void query(const AABB_t& aabb, const T& callback) const;
+	template<class AABBType, typename T>
+	void query(const AABBType& aabb, const T& callback) const;
+	// Append indices of all leaves intersecting aabb to hits, returns number of appended leaves
+	uint query(const AABB_t& aabb, std::vector<index_t>& hits) const;
+
+	const ValueType& operator[](index_t idx) const;
+	// Tree (fat) AABB of leaf idx
+	const AABB_t& aabb(index_t idx) const;
+
+	uint count() const { return _header ? _header->count : 0; }
+
+  private:
+	using Node = typename Tree::Node;
+	using Header = AABBTreeSnapshotHeader;
+
+	bool openSnapshot(const void* data, std::size_t size, Validate validate);
+	// Every reachable index is in range, parent links match and there are count leaves, so the hierarchy is a tree
+	static bool isValidTree(const Header& header, const Node* nodes);
+
+	// Traversal behind box queries, callback(index_t leafIdx) -> bool
+	template<typename T>
+	void queryLeaves(const AABB_t& aabb, const T& callback) const;
+
+  private:
+	const Header* _header = nullptr;
+	const Node* _nodes = nullptr;
+	const ValueType* _values = nullptr;
+
+	// Storage owned by the view when opened from a file
+	void* _mapping = nullptr;
+	std::size_t _mappingSize = 0;
+};
+
+template<class ValueType, uint N, class KeyElementType>
+AABBTreeView<ValueType, N, KeyElementType>::~AABBTreeView() {
+	close();
+}
+
+template<class ValueType, uint N, class KeyElementType>
+AABBTreeView<ValueType, N, KeyElementType>::AABBTreeView(AABBTreeView&& other) noexcept {
+	*this = std::move(other);
+}
+
+template<class ValueType, uint N, class KeyElementType>
+AABBTreeView<ValueType, N, KeyElementType>& AABBTreeView<ValueType, N, KeyElementType>::operator=(
+    AABBTreeView&& other) noexcept {
+	std::swap(_header, other._header);
+	std::swap(_nodes, other._nodes);
+	std::swap(_values, other._values);
+	std::swap(_mapping, other._mapping);
+	std::swap(_mappingSize, other._mappingSize);
+
+	return *this;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+bool AABBTreeView<ValueType, N, KeyElementType>::open(const void* data, std::size_t size, Validate validate) {
+	close();
+
+	return openSnapshot(data, size, validate);
+}
+
+template<class ValueType, uint N, class KeyElementType>
+bool AABBTreeView<ValueType, N, KeyElementType>::openSnapshot(
+    const void* data, std::size_t size, Validate validate) {
+	static_assert(std::is_trivially_copyable_v<ValueType>, "Only trivially copyable values can be saved");
+
+	const auto address = reinterpret_cast<std::uintptr_t>(data);
+	if (size < sizeof(Header) || address % alignof(Header) || address % alignof(Node) ||
+	    address % alignof(ValueType)) {
+		return false;
+	}
+
+	const auto& header = *static_cast<const Header*>(data);
+	constexpr auto floatingPoint = std::is_floating_point_v<KeyElementType>;
+	constexpr std::uint32_t flags =
+	    (Tree::INLINE_VALUES ? std::uint32_t(Header::INLINE_VALUES) : std::uint32_t(0)) |
+	    (floatingPoint ? std::uint32_t(Header::FLOATING_POINT_KEY) : std::uint32_t(0));
+	if (std::memcmp(header.magic, Header::MAGIC, sizeof(header.magic)) != 0 || header.version != Header::VERSION ||
+	    header.byteOrder != Header::ENDIAN_TAG || header.dimensions != N ||
+	    header.keySize != sizeof(KeyElementType) || header.indexSize != sizeof(index_t) ||
+	    header.nodeSize != sizeof(Node) || header.valueSize != sizeof(ValueType) || header.flags != flags) {
+		return false;
+	}
+
+	// Untrusted sizes are checked without overflowing
+	if (header.size > size || header.nodesOffset > header.size ||
+	    header.nodesCapacity > (header.size - header.nodesOffset) / sizeof(Node) ||
+	    header.valuesOffset > header.size ||
+	    header.valuesCapacity > (header.size - header.valuesOffset) / sizeof(ValueType) ||
+	    header.nodesOffset % Header::ALIGNMENT || header.valuesOffset % Header::ALIGNMENT ||
+	    (header.root != nullindex && header.root >= header.nodesCapacity)) {
+		return false;
+	}
+
+	const auto nodes = reinterpret_cast<const Node*>(static_cast<const char*>(data) + header.nodesOffset);
+	if (validate == Validate::Full && !isValidTree(header, nodes)) {
+		return false;
+	}
+
+	_header = &header;
+	_nodes = nodes;
+	_values = reinterpret_cast<const ValueType*>(static_cast<const char*>(data) + header.valuesOffset);
+
+	return true;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+bool AABBTreeView<ValueType, N, KeyElementType>::isValidTree(const Header& header, const Node* nodes) {
+	if (header.root == nullindex) {
+		return header.count == 0;
+	}
+	if (nodes[header.root].parent != nullindex) {
+		return false;
+	}
+
+	// A child is accepted only from its own parent, so no node is reached twice and cycles end the walk
+	std::uint64_t leaves = 0;
+	std::uint64_t visited = 0;
+	GrowableStack<index_t, 256> stack;
+	stack.push(index_t(header.root));
+	while (stack.count() > 0) {
+		const auto nodeIdx = stack.pop();
+		const Node& node = nodes[nodeIdx];
+		if (++visited > header.nodesCapacity) {
+			return false;
+		}
+
+		if (node.isLeaf()) {
+			if constexpr (!Tree::INLINE_VALUES) {
+				if (node.dataIdx >= header.valuesCapacity) {
+					return false;
+				}
+			}
+			++leaves;
+			continue;
+		}
+
+		if (node.child1 >= header.nodesCapacity || node.child2 >= header.nodesCapacity || node.child1 == node.child2 ||
+		    nodes[node.child1].parent != nodeIdx || nodes[node.child2].parent != nodeIdx) {
+			return false;
+		}
+		stack.push(node.child1);
+		stack.push(node.child2);
+	}
+
+	return leaves == header.count;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+bool AABBTreeView<ValueType, N, KeyElementType>::open(const std::filesystem::path& path, Validate validate) {
+	close();
+
+#if defined(__unix__) || defined(__APPLE__)
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	// Mapping keeps the file open
+	void* mapping = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (mapping == MAP_FAILED) {
+		return false;
+	}
+	_mapping = mapping;
+	_mappingSize = st.st_size;
+#else
+	std::ifstream stream(path, std::ios::binary | std::ios::ate);
+	if (!stream) {
+		return false;
+	}
+	const std::size_t size = stream.tellg();
+	_mapping = ::operator new(size, std::align_val_t(Header::ALIGNMENT));
+	_mappingSize = size;
+	stream.seekg(0);
+	if (!stream.read(static_cast<char*>(_mapping), size)) {
+		close();
+		return false;
+	}
+#endif
+
+	if (!openSnapshot(_mapping, _mappingSize, validate)) {
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void AABBTreeView<ValueType, N, KeyElementType>::close() {
+	if (_mapping) {
+#if defined(__unix__) || defined(__APPLE__)
+		::munmap(_mapping, _mappingSize);
+#else
+		::operator delete(_mapping, std::align_val_t(Header::ALIGNMENT));
+#endif
+	}
+
+	_header = nullptr;
+	_nodes = nullptr;
+	_values = nullptr;
+	_mapping = nullptr;
+	_mappingSize = 0;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<class AABBType, typename T>
+void AABBTreeView<ValueType, N, KeyElementType>::query(const AABBType& uaabb, const T& callback) const {
+	AABB_t aabb;
+	aabb.set(uaabb);
+	query(aabb, callback);
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<typename T>
+void AABBTreeView<ValueType, N, KeyElementType>::query(const AABB_t& aabb, const T& callback) const {
+	queryLeaves(aabb, [this, &callback](index_t leafIdx) { return callback(Handle(leafIdx, (*this)[leafIdx])); });
+}
+
+template<class ValueType, uint N, class KeyElementType>
+uint AABBTreeView<ValueType, N, KeyElementType>::query(const AABB_t& aabb, std::vector<index_t>& hits) const {
+	const auto size = hits.size();
+	queryLeaves(aabb, [&hits](index_t leafIdx) {
+		hits.push_back(leafIdx);
+		return true;
+	});
+
+	return hits.size() - size;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<typename T>
+void AABBTreeView<ValueType, N, KeyElementType>::queryLeaves(const AABB_t& aabb, const T& callback) const {
+	if (!_header || _header->root == nullindex) {
+		return;
+	}
+
+	GrowableStack<index_t, 256> stack;
+	stack.push(_header->root);
+	while (stack.count() > 0) {
+		const Node& node = _nodes[stack.pop()];
+		if (!node.aabb.isIntersecting(aabb)) {
+			continue;
+		}
+
+		if (node.isLeaf()) {
+			if (!callback(index_t(&node - _nodes))) {
+				return;
+			}
+		} else {
+			stack.push(node.child1);
+			stack.push(node.child2);
+		}
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+const ValueType& AABBTreeView<ValueType, N, KeyElementType>::operator[](index_t idx) const {
+	assert(_header && idx < _header->nodesCapacity && _nodes[idx].isLeaf());
+
+	if constexpr (Tree::INLINE_VALUES) {
+		return _nodes[idx].value();
+	} else {
+		assert(_nodes[idx].dataIdx < _header->valuesCapacity);
+		return _values[_nodes[idx].dataIdx];
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+const typename AABBTreeView<ValueType, N, KeyElementType>::AABB_t& AABBTreeView<ValueType, N, KeyElementType>::aabb(
+    index_t idx) const {
+	assert(_header && idx < _header->nodesCapacity);
+
+	return _nodes[idx].aabb;
+}
+
+} // namespace biss
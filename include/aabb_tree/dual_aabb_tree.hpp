@@ -0,0 +1,205 @@
+#pragma once
+
+#include "aabb_tree.hpp"
+
+#include <queue>
+
+namespace biss {
+
+// Two trees over one set of objects: a tight static tree for objects that stopped moving and a fat dynamic tree
+// for the rest. Moving objects are reinserted and rotated only among other moving objects, the static tree
+// is left alone by them.
+// An object that didn't change for sleepFrames calls of step() migrates to the static tree and back
+// on the next update() that changes its AABB. Queries run over both trees.
+// Object indices are stable for the whole life of an object, no matter which tree holds it.
+template<class ValueType, uint N, class KeyElementType>
+class DualAABBTree {
+  public:
+	// Leaves keep object indices
+	using Tree = AABBTree<index_t, N, KeyElementType>;
+	using AABB_t = typename Tree::AABB_t;
+	using Real_t = typename Tree::Real_t;
+
+	// aabbExtension and aabbMultiplier are used by the dynamic tree only
+	explicit DualAABBTree(KeyElementType aabbExtension = 0, KeyElementType aabbMultiplier = 0, uint sleepFrames = 60);
+
+	// New objects start in the dynamic tree
+	template<class... Args>
+	index_t emplace(const AABB_t& aabb, Args&&... args);
+	void remove(index_t idx);
+	// Same AABB as before doesn't count as a change
+	void update(
+	    index_t idx, const AABB_t& aabb, const typename AABB_t::Vec_t& displacement = typename AABB_t::Vec_t(0));
+
+	// End of frame, objects unchanged for sleepFrames frames are moved to the static tree
+	void step();
+
+	// callback(index_t) -> bool is called for every object intersecting aabb, return false to stop
+	template<typename T>
+	void query(const AABB_t& aabb, const T& callback) const;
+	// Same callback protocol as AABBTree::raycast(). Hits are nearest first within each tree,
+	// the static tree is cast first and clips the segment for the dynamic one.
+	template<typename T>
+	void raycast(const typename AABB_t::Vec_t& origin, const typename AABB_t::Vec_t& direction, Real_t maxFraction,
+	    const T& callback) const;
+
+	ValueType& operator[](index_t idx) { return _objects[idx].value; }
+	const ValueType& operator[](index_t idx) const { return _objects[idx].value; }
+	// Tight AABB passed to emplace() or the last update()
+	const AABB_t& aabb(index_t idx) const { return _objects[idx].aabb; }
+	bool isStatic(index_t idx) const { return _objects[idx].isStatic; }
+
+	uint count() const { return _objects.count(); }
+
+	const Tree& staticTree() const { return _static; }
+	const Tree& dynamicTree() const { return _dynamic; }
+
+  private:
+	struct Object {
+		template<class... Args>
+		Object(const AABB_t& aabb, uint frame, Args&&... args):
+		    aabb(aabb), value(std::forward<Args>(args)...), lastChange(frame) {}
+
+		AABB_t aabb;
+		ValueType value;
+		index_t leafIdx = nullindex;
+		uint lastChange; // frame of the last change
+		bool isStatic = false;
+	};
+
+	// Object changed in frame, checked by step() once it is sleepFrames old
+	struct Change {
+		index_t idx;
+		uint frame;
+	};
+
+	void markChanged(index_t idx);
+
+  private:
+	Tree _static;
+	Tree _dynamic;
+	Indexer<Object> _objects;
+
+	// In frame order, entries of objects changed again or removed since are skipped
+	std::queue<Change> _changes;
+	uint _frame = 0;
+	uint _sleepFrames;
+};
+
+template<class ValueType, uint N, class KeyElementType>
+DualAABBTree<ValueType, N, KeyElementType>::DualAABBTree(
+    KeyElementType aabbExtension, KeyElementType aabbMultiplier, uint sleepFrames):
+    _dynamic(aabbExtension, aabbMultiplier), _sleepFrames(sleepFrames) {
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<class... Args>
+index_t DualAABBTree<ValueType, N, KeyElementType>::emplace(const AABB_t& aabb, Args&&... args) {
+	const auto idx = _objects.emplace(aabb, _frame, std::forward<Args>(args)...);
+	_objects[idx].leafIdx = _dynamic.emplace(aabb, idx);
+	_changes.push(Change{idx, _frame});
+
+	return idx;
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void DualAABBTree<ValueType, N, KeyElementType>::remove(index_t idx) {
+	const Object& object = _objects[idx];
+	(object.isStatic ? _static : _dynamic).remove(object.leafIdx);
+	_objects.remove(idx);
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void DualAABBTree<ValueType, N, KeyElementType>::update(
+    index_t idx, const AABB_t& aabb, const typename AABB_t::Vec_t& displacement) {
+	Object& object = _objects[idx];
+
+	bool changed = false;
+	for (uint i = 0; i != N; ++i) {
+		changed |= object.aabb.lb.point[i] != aabb.lb.point[i] || object.aabb.ub.point[i] != aabb.ub.point[i];
+	}
+	if (!changed) {
+		return;
+	}
+
+	object.aabb = aabb;
+	if (object.isStatic) {
+		_static.remove(object.leafIdx);
+		object.leafIdx = _dynamic.emplace(aabb, idx);
+		object.isStatic = false;
+	} else {
+		_dynamic.update(object.leafIdx, aabb, displacement);
+	}
+
+	markChanged(idx);
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void DualAABBTree<ValueType, N, KeyElementType>::markChanged(index_t idx) {
+	Object& object = _objects[idx];
+	// One entry per object and frame is enough
+	if (object.lastChange != _frame) {
+		object.lastChange = _frame;
+		_changes.push(Change{idx, _frame});
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+void DualAABBTree<ValueType, N, KeyElementType>::step() {
+	++_frame;
+
+	while (!_changes.empty() && _frame - _changes.front().frame >= _sleepFrames) {
+		const auto change = _changes.front();
+		_changes.pop();
+
+		// Removed, changed later, or the slot was reused by another object
+		if (!_objects.contains(change.idx)) {
+			continue;
+		}
+		Object& object = _objects[change.idx];
+		if (object.isStatic || object.lastChange != change.frame) {
+			continue;
+		}
+
+		_dynamic.remove(object.leafIdx);
+		object.leafIdx = _static.emplace(object.aabb, change.idx);
+		object.isStatic = true;
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<typename T>
+void DualAABBTree<ValueType, N, KeyElementType>::query(const AABB_t& aabb, const T& callback) const {
+	bool proceed = true;
+	const auto report = [&callback, &proceed](auto hit) { return proceed = callback(index_t(*hit)); };
+
+	_static.query(aabb, report);
+	if (proceed) {
+		_dynamic.query(aabb, report);
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType>
+template<typename T>
+void DualAABBTree<ValueType, N, KeyElementType>::raycast(const typename AABB_t::Vec_t& origin,
+    const typename AABB_t::Vec_t& direction, Real_t maxFraction, const T& callback) const {
+	bool stopped = false;
+	_static.raycast(origin, direction, maxFraction,
+	    [this, &callback, &stopped, &maxFraction](index_t leafIdx, Real_t fraction) -> Real_t {
+		    const auto result = callback(_static[leafIdx], fraction);
+		    if (result == 0) {
+			    stopped = true;
+		    } else if (result > 0 && result < maxFraction) {
+			    maxFraction = result;
+		    }
+		    return result;
+	    });
+	if (stopped) {
+		return;
+	}
+
+	_dynamic.raycast(origin, direction, maxFraction,
+	    [this, &callback](index_t leafIdx, Real_t fraction) { return callback(_dynamic[leafIdx], fraction); });
+}
+
+} // namespace biss
@@ -0,0 +1,339 @@
+#pragma once
+
+#include "aabb_tree.hpp"
+
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+namespace biss {
+
+// Immutable compressed copy of AABBTree for static objects.
+// Nodes are stored in depth-first order, the first child follows its parent, so a node only keeps the index of
+// the second one. Bounds are quantised to QuantType offsets inside the parent bounds, rounded outwards,
+// so queries may report a few more leaves than the source tree, never fewer.
+// Values are copied, reported indices are leaf indices of the source tree.
+template<class ValueType, uint N, class KeyElementType, class QuantType = std::uint16_t>
+class FrozenAABBTree {
+  public:
+	using Tree = AABBTree<ValueType, N, KeyElementType>;
+	using AABB_t = typename Tree::AABB_t;
+	using Real_t = typename Tree::Real_t;
+	using Handle = AABBTreeHandle<const ValueType>;
+
+	explicit FrozenAABBTree(const Tree& tree);
+
+	// callback(Handle) -> bool, return false to stop
+	template<typename T>
+	void query(const AABB_t& aabb, const T& callback) const;
+	template<class AABBType, typename T>
+	void query(const AABBType& aabb, const T& callback) const;
+	// Append indices of all leaves intersecting aabb to hits, returns number of appended leaves
+	uint query(const AABB_t& aabb, std::vector<index_t>& hits) const;
+
+	// Same contract as AABBTree::raycast(), callback(index_t, Real_t fraction) -> Real_t
+	template<typename T>
+	void raycast(const typename AABB_t::Vec_t& origin, const typename AABB_t::Vec_t& direction, Real_t maxFraction,
+	    const T& callback) const;
+	template<class VecType, typename T>
+	void raycast(const VecType& origin, const VecType& direction, Real_t maxFraction, const T& callback) const;
+
+	uint count() const { return _values.size(); }
+	uint nodesCount() const { return _nodes.size(); }
+	// Bytes taken by nodes, values and leaf indices
+	std::size_t memoryUsage() const;
+
+  private:
+	static_assert(std::is_unsigned_v<QuantType> && std::is_integral_v<QuantType>);
+
+	static constexpr QuantType QMAX = std::numeric_limits<QuantType>::max();
+	// Set in next for leaves, the rest is the value index
+	static constexpr index_t LEAF_BIT = ~nullindex;
+
+	using Box = AABB<N, Real_t>;
+
+	struct Node {
+		QuantType lb[N];
+		QuantType ub[N];
+		// Index of the second child, or LEAF_BIT | value index
+		index_t next;
+	};
+
+	// Bounds are decoded during traversal from the parent bounds, top-down
+	static Real_t decode(QuantType q, Real_t lb, Real_t ub) {
+		return q == QMAX ? ub : lb + (ub - lb) * (Real_t(q) * (Real_t{1} / QMAX));
+	}
+	static Box decode(const Node& node, const Box& parent);
+	// Quantise child bounds inside parent and store them to node, returns decoded bounds
+	static Box quantise(const AABB_t& aabb, const Box& parent, Node& node);
+
+	template<typename T>
+	void queryLeaves(const Box& aabb, const T& callback) const;
+
+  private:
+	std::vector<Node> _nodes;
+	Box _aabb;
+	std::vector<ValueType> _values;
+	std::vector<index_t> _leafIdxs;
+};
+
+template<class ValueType, uint N, class KeyElementType, class QuantType>
+FrozenAABBTree<ValueType, N, KeyElementType, QuantType>::FrozenAABBTree(const Tree& tree) {
+	if (tree._root == nullindex) {
+		return;
+	}
+
+	const auto& root = tree._nodes[tree._root].aabb;
+	for (uint i = 0; i != N; ++i) {
+		_aabb.lb.point[i] = Real_t(root.lb.point[i]);
+		_aabb.ub.point[i] = Real_t(root.ub.point[i]);
+	}
+
+	_nodes.reserve(tree._nodes.count());
+	_values.reserve(tree.count());
+	_leafIdxs.reserve(tree.count());
+
+	struct Task {
+		index_t source;
+		// Node waiting for the index of its second child, nullindex for first children
+		index_t parent;
+		Box parentAABB;
+	};
+	GrowableStack<Task, 64> stack;
+
+	stack.push(Task{tree._root, nullindex, _aabb});
+	while (stack.count() > 0) {
+		const auto task = stack.pop();
+		const index_t target = _nodes.size();
+		if (task.parent != nullindex) {
+			_nodes[task.parent].next = target;
+		}
+
+		const auto& source = tree._nodes[task.source];
+		_nodes.emplace_back();
+		const auto aabb = quantise(source.aabb, task.parentAABB, _nodes[target]);
+
+		if (source.isLeaf()) {
+			_nodes[target].next = LEAF_BIT | index_t(_values.size());
+			_values.push_back(tree.leafValue(task.source));
+			_leafIdxs.push_back(task.source);
+		} else {
+			stack.push(Task{source.child2, target, aabb});
+			stack.push(Task{source.child1, nullindex, aabb});
+		}
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType, class QuantType>
+typename FrozenAABBTree<ValueType, N, KeyElementType, QuantType>::Box
+FrozenAABBTree<ValueType, N, KeyElementType, QuantType>::decode(const Node& node, const Box& parent) {
+	Box aabb;
+	for (uint i = 0; i != N; ++i) {
+		aabb.lb.point[i] = decode(node.lb[i], parent.lb.point[i], parent.ub.point[i]);
+		aabb.ub.point[i] = decode(node.ub[i], parent.lb.point[i], parent.ub.point[i]);
+	}
+
+	return aabb;
+}
+
+template<class ValueType, uint N, class KeyElementType, class QuantType>
+typename FrozenAABBTree<ValueType, N, KeyElementType, QuantType>::Box
+FrozenAABBTree<ValueType, N, KeyElementType, QuantType>::quantise(const AABB_t& aabb, const Box& parent, Node& node) {
+	for (uint i = 0; i != N; ++i) {
+		const auto plb = parent.lb.point[i];
+		const auto pub = parent.ub.point[i];
+		const auto lb = Real_t(aabb.lb.point[i]);
+		const auto ub = Real_t(aabb.ub.point[i]);
+		if (!(plb < pub)) {
+			node.lb[i] = 0;
+			node.ub[i] = QMAX;
+			continue;
+		}
+
+		// Bound of the rounding error of decode(): half an ulp of the result plus the error of the product.
+		// It holds for any rounding of the expression (e.g. fused multiply-add during traversal).
+		// Bounds are rounded outwards by it in double, so the Real_t decode stays outside of the exact ones.
+		const auto eps = double(std::numeric_limits<Real_t>::epsilon());
+		const auto magnitude = std::abs(plb) > std::abs(pub) ? std::abs(plb) : std::abs(pub);
+		const auto margin = eps * (double(magnitude) / 2 + 4 * (double(pub) - double(plb)));
+		const auto scale = double(QMAX) / (double(pub) - double(plb));
+
+		// Decoding 0 and QMAX is exact, the parent bounds themselves
+		const auto qlb = std::floor((double(lb) - margin - double(plb)) * scale);
+		auto q = QuantType(qlb < 0 ? 0 : qlb > QMAX ? QMAX : qlb);
+		if (q > 0 && decode(q, plb, pub) > lb) {
+			--q;
+		}
+		node.lb[i] = q;
+
+		const auto qub = std::ceil((double(ub) + margin - double(plb)) * scale);
+		q = QuantType(qub < 0 ? 0 : qub > QMAX ? QMAX : qub);
+		if (q < QMAX && decode(q, plb, pub) < ub) {
+			++q;
+		}
+		node.ub[i] = q;
+	}
+
+	return decode(node, parent);
+}
+
+template<class ValueType, uint N, class KeyElementType, class QuantType>
+template<class AABBType, typename T>
+void FrozenAABBTree<ValueType, N, KeyElementType, QuantType>::query(const AABBType& uaabb, const T& callback) const {
+	AABB_t aabb;
+	aabb.set(uaabb);
+	query(aabb, callback);
+}
+
+template<class ValueType, uint N, class KeyElementType, class QuantType>
+template<typename T>
+void FrozenAABBTree<ValueType, N, KeyElementType, QuantType>::query(const AABB_t& aabb, const T& callback) const {
+	Box box;
+	for (uint i = 0; i != N; ++i) {
+		box.lb.point[i] = Real_t(aabb.lb.point[i]);
+		box.ub.point[i] = Real_t(aabb.ub.point[i]);
+	}
+
+	queryLeaves(box, [this, &callback](index_t valueIdx) {
+		return callback(Handle(_leafIdxs[valueIdx], _values[valueIdx]));
+	});
+}
+
+template<class ValueType, uint N, class KeyElementType, class QuantType>
+uint FrozenAABBTree<ValueType, N, KeyElementType, QuantType>::query(
+    const AABB_t& aabb, std::vector<index_t>& hits) const {
+	const auto size = hits.size();
+	query(aabb, [&hits](Handle hit) {
+		hits.push_back(hit);
+		return true;
+	});
+
+	return hits.size() - size;
+}
+
+template<class ValueType, uint N, class KeyElementType, class QuantType>
+template<typename T>
+void FrozenAABBTree<ValueType, N, KeyElementType, QuantType>::queryLeaves(const Box& aabb, const T& callback) const {
+	if (_nodes.empty() || !_aabb.isIntersecting(aabb)) {
+		return;
+	}
+
+	// Nodes are pushed with decoded bounds that already passed the test
+	struct Entry {
+		index_t idx;
+		Box aabb;
+	};
+	GrowableStack<Entry, 64> stack;
+
+	stack.push(Entry{0, _aabb});
+	while (stack.count() > 0) {
+		const auto entry = stack.pop();
+		const Node& node = _nodes[entry.idx];
+		if (node.next & LEAF_BIT) {
+			if (!callback(node.next & ~LEAF_BIT)) {
+				return;
+			}
+			continue;
+		}
+
+		const auto aabb2 = decode(_nodes[node.next], entry.aabb);
+		if (aabb2.isIntersecting(aabb)) {
+			stack.push(Entry{node.next, aabb2});
+		}
+		const auto aabb1 = decode(_nodes[entry.idx + 1], entry.aabb);
+		if (aabb1.isIntersecting(aabb)) {
+			stack.push(Entry{entry.idx + 1, aabb1});
+		}
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType, class QuantType>
+template<class VecType, typename T>
+void FrozenAABBTree<ValueType, N, KeyElementType, QuantType>::raycast(
+    const VecType& origin, const VecType& direction, Real_t maxFraction, const T& callback) const {
+	typename AABB_t::Vec_t nOrigin;
+	nOrigin.set(origin);
+	typename AABB_t::Vec_t nDirection;
+	nDirection.set(direction);
+	raycast(nOrigin, nDirection, maxFraction, callback);
+}
+
+template<class ValueType, uint N, class KeyElementType, class QuantType>
+template<typename T>
+void FrozenAABBTree<ValueType, N, KeyElementType, QuantType>::raycast(const typename AABB_t::Vec_t& origin,
+    const typename AABB_t::Vec_t& direction, Real_t maxFraction, const T& callback) const {
+	if (_nodes.empty()) {
+		return;
+	}
+
+	typename Tree::Ray ray;
+	for (uint i = 0; i != N; ++i) {
+		ray.origin[i] = Real_t(origin.point[i]);
+		ray.direction[i] = Real_t(direction.point[i]);
+		ray.invDirection[i] = ray.direction[i] != Real_t{0} ? Real_t{1} / ray.direction[i] : Real_t{0};
+	}
+
+	struct Entry {
+		index_t idx;
+		Real_t fraction;
+		Box aabb;
+	};
+	GrowableStack<Entry, 64> stack;
+
+	Real_t fraction;
+	if (Tree::raycast(_aabb, ray, maxFraction, fraction)) {
+		stack.push(Entry{0, fraction, _aabb});
+	}
+
+	while (stack.count() > 0) {
+		const auto entry = stack.pop();
+		// The segment could have been clipped after the node was pushed
+		if (entry.fraction > maxFraction) {
+			continue;
+		}
+
+		const Node& node = _nodes[entry.idx];
+		if (node.next & LEAF_BIT) {
+			const Real_t value = callback(_leafIdxs[node.next & ~LEAF_BIT], entry.fraction);
+			if (value == Real_t{0}) {
+				return;
+			}
+			if (value > Real_t{0}) {
+				maxFraction = value < maxFraction ? value : maxFraction;
+			}
+			continue;
+		}
+
+		const index_t child1 = entry.idx + 1;
+		const index_t child2 = node.next;
+		const auto aabb1 = decode(_nodes[child1], entry.aabb);
+		const auto aabb2 = decode(_nodes[child2], entry.aabb);
+		Real_t fraction1;
+		Real_t fraction2;
+		const bool hit1 = Tree::raycast(aabb1, ray, maxFraction, fraction1);
+		const bool hit2 = Tree::raycast(aabb2, ray, maxFraction, fraction2);
+
+		// Push the far child first so the near one is visited first
+		if (hit1 && hit2) {
+			if (fraction1 <= fraction2) {
+				stack.push(Entry{child2, fraction2, aabb2});
+				stack.push(Entry{child1, fraction1, aabb1});
+			} else {
+				stack.push(Entry{child1, fraction1, aabb1});
+				stack.push(Entry{child2, fraction2, aabb2});
+			}
+		} else if (hit1) {
+			stack.push(Entry{child1, fraction1, aabb1});
+		} else if (hit2) {
+			stack.push(Entry{child2, fraction2, aabb2});
+		}
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType, class QuantType>
+std::size_t FrozenAABBTree<ValueType, N, KeyElementType, QuantType>::memoryUsage() const {
+	return _nodes.size() * sizeof(Node) + _values.size() * sizeof(ValueType) + _leafIdxs.size() * sizeof(index_t);
+}
+
+} // namespace biss
@@ -4,33 +4,36 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <memory_resource>
 
 namespace biss {
 
 template<typename T, uint N>
 class GrowableStack {
   public:
-	GrowableStack() {
+	// Overflow storage is taken from resource, malloc/free when it is nullptr
+	explicit GrowableStack(std::pmr::memory_resource* resource = nullptr) {
 		_stack = _array;
 		_count = 0;
 		_capacity = N;
+		_resource = resource;
 	}
 
 	~GrowableStack() {
 		if (_stack != _array) {
-			free(_stack);
+			deallocate(_stack, _capacity);
 		}
 	}
 
 	void push(const T& element) {
 		if (_count == _capacity) {
 			T* old = _stack;
-			_capacity *= 2;
-			_stack = (T*)malloc(_capacity * sizeof(T));
+			_stack = allocate(_capacity * 2);
 			memcpy(_stack, old, _count * sizeof(T));
 			if (old != _array) {
-				free(old);
+				deallocate(old, _capacity);
 			}
+			_capacity *= 2;
 		}
 
 		_stack[_count] = element;
@@ -44,13 +47,33 @@ class GrowableStack {
 
 	uint count() const { return _count; }
 
+	// Heap storage is kept for reuse
+	void clear() { _count = 0; }
+
 	bool isHeap() const { return _stack != _array; }
 
+  private:
+	T* allocate(uint capacity) {
+		if (!_resource) {
+			return (T*)malloc(capacity * sizeof(T));
+		}
+		return (T*)_resource->allocate(capacity * sizeof(T), alignof(T));
+	}
+
+	void deallocate(T* stack, uint capacity) {
+		if (!_resource) {
+			free(stack);
+		} else {
+			_resource->deallocate(stack, capacity * sizeof(T), alignof(T));
+		}
+	}
+
   private:
 	T* _stack;
 	T _array[N];
 	uint _count;
 	uint _capacity;
+	std::pmr::memory_resource* _resource;
 };
 
 } // namespace biss
\ No newline at end of file
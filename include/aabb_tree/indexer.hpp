@@ -1,8 +1,15 @@
 #pragma once
 
+#include "typedefs.hpp"
+
+#include <bit>
 #include <cassert>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <memory_resource>
 #include <new>
+#include <type_traits>
 #include <utility>
 
 namespace biss {
@@ -10,27 +17,40 @@ namespace biss {
 template<class Data>
 class Indexer {
   private:
-	struct Node {
-		static constexpr auto NEXT_BITS_COUNT = (8 * sizeof(uint)) - 1;
-		uint free : 1;
-		uint next: NEXT_BITS_COUNT;
+	// Free slots keep the free list link in place of data, occupancy is tracked in a separate bitmap
+	union Node {
+		index_t next;
 		Data data;
 	};
+	using Word = std::uint64_t;
+	static constexpr uint WORD_BITS = 64;
+	static constexpr std::size_t ALIGNMENT = alignof(Node) > alignof(Word) ? alignof(Node) : alignof(Word);
 
   public:
-	using index_t = uint;
+	using index_t = biss::index_t;
 
-	Indexer(uint initialCapacity = 0);
+	// Storage is taken from resource, std::malloc/std::free when it is nullptr
+	explicit Indexer(uint initialCapacity = 0, std::pmr::memory_resource* resource = nullptr);
 	~Indexer();
 
-	Indexer(const Indexer& other) = delete;
+	// Copies keep indices and the free list. Copy takes the resource of other, assignment keeps its own
+	// and reuses storage when capacities match.
+	Indexer(const Indexer& other);
+	Indexer& operator=(const Indexer& other);
 	Indexer(Indexer&& other) noexcept;
+	Indexer& operator=(Indexer&& other) noexcept;
 
 	template<class... Args>
 	index_t emplace(Args&&... args);
 
 	index_t create();
 
+	// Grow storage so that at least `capacity` elements fit without reallocation
+	bool reserve(uint capacity);
+	// Release free slots at the end of storage. Elements never move to other slots,
+	// so storage can't shrink below the highest used index.
+	bool shrinkToFit();
+
 	void remove(index_t idx);
 
 	bool contains(index_t idx) const;
@@ -41,6 +61,8 @@ class Indexer {
 	uint capacity() const;
 	uint count() const;
 
+	std::pmr::memory_resource* resource() const { return _resource; }
+
 	class Iterator {
 	  public:
 		auto& operator*() const;
@@ -58,36 +80,66 @@ class Indexer {
 
 	  private:
 		friend class Indexer;
-		Iterator(Node* begin, Node* it, Node* end): _begin(begin), _it(it), _end(end) {}
+		Iterator(Node* begin, Node* it, Node* end, const Word* occupied):
+		    _begin(begin), _it(it), _end(end), _occupied(occupied) {}
 
 	  private:
 		Node* _begin;
 		Node* _it;
 		Node* _end;
+		const Word* _occupied;
 	};
 
 	Iterator begin() const;
 	Iterator end() const;
+	// Iterator pointing to the element idx
+	Iterator iteratorAt(index_t idx) const;
 
 	void remove(const Iterator& iterator);
 
+  private:
+	static bool isOccupied(const Word* occupied, uint idx) { return occupied[idx / WORD_BITS] >> (idx % WORD_BITS) & 1; }
+	// First occupied slot at or after idx, capacity if there is none
+	static uint findOccupied(const Word* occupied, uint idx, uint capacity);
+	static uint wordsCount(uint capacity) { return (capacity + WORD_BITS - 1) / WORD_BITS; }
+
+	void* allocate(std::size_t size);
+	void deallocate(void* ptr, std::size_t size);
+	// Like std::realloc, ptr is kept on failure
+	void* reallocate(void* ptr, std::size_t oldSize, std::size_t newSize);
+
+	void destroyAll();
+	// Copy slots of other into storage of the same capacity
+	void copySlots(const Indexer& other);
+
+	bool grow(uint newCapacity);
+	// Move storage to a block of newCapacity slots, slots past it must be free. New slots are not initialized.
+	bool relocate(uint newCapacity);
+
   private:
 	Node* _nodes;
+	// Bit per slot, bits past capacity are always 0
+	Word* _occupied;
+	// Bitmap size, may be larger than capacity needs if shrinking failed
+	uint _wordsCount;
 	uint _capacity;
 	uint _count;
-	uint _freeNode;
+	index_t _freeNode;
+	// Lowest occupied slot (or capacity) for O(1) begin()
+	uint _first;
+	std::pmr::memory_resource* _resource;
 };
 
 template<class Data>
 auto& Indexer<Data>::Iterator::operator*() const {
-	assert(_it && !_it->free);
+	assert(_it && isOccupied(_occupied, _it - _begin));
 
 	return _it->data;
 }
 
 template<class Data>
 auto& Indexer<Data>::Iterator::operator->() const {
-	assert(_it && !_it->free);
+	assert(_it && isOccupied(_occupied, _it - _begin));
 
 	return _it->data;
 }
@@ -96,7 +148,7 @@ template<class Data>
 const auto Indexer<Data>::Iterator::operator++(int) {
 	assert(_it);
 
-	while (++_it != _end && _it->free) {}
+	_it = _begin + findOccupied(_occupied, _it - _begin + 1, _end - _begin);
 
 	return *this;
 }
@@ -105,8 +157,8 @@ template<class Data>
 const auto Indexer<Data>::Iterator::operator++() {
 	assert(_it);
 
-	auto copy = Iterator(_begin, _it, _end);
-	while (++_it != _end && _it->free) {}
+	auto copy = Iterator(_begin, _it, _end, _occupied);
+	_it = _begin + findOccupied(_occupied, _it - _begin + 1, _end - _begin);
 
 	return copy;
 }
@@ -130,76 +182,246 @@ const auto Indexer<Data>::Iterator::operator+(int d) {
 }
 
 template<class Data>
-Indexer<Data>::Indexer(uint initialCapacity) {
-	_capacity = initialCapacity;
-	_count = 0;
+Indexer<Data>::Indexer(uint initialCapacity, std::pmr::memory_resource* resource):
+    _nodes(nullptr), _occupied(nullptr), _wordsCount(0), _capacity(0), _count(0), _freeNode(nullindex), _first(0),
+    _resource(resource) {
+	if (initialCapacity) {
+		grow(initialCapacity);
+	}
+}
 
-	if (_capacity) {
-		_nodes = static_cast<Node*>(std::malloc(_capacity * sizeof(Node)));
-		if (_nodes) {
+template<class Data>
+Indexer<Data>::~Indexer() {
+	destroyAll();
 
-			for (uint i = 0; i != _capacity - 1; ++i) {
-				Node& node = _nodes[i];
-				node.next = i + 1;
-				node.free = 1;
-			}
-			auto& node = _nodes[_capacity - 1];
-			node.next = nullindex;
-			node.free = 1;
-			_freeNode = 0;
-		} else {
-			_capacity = 0;
-			_freeNode = nullindex;
+	deallocate(_nodes, _capacity * sizeof(Node));
+	deallocate(_occupied, _wordsCount * sizeof(Word));
+}
+
+template<class Data>
+void Indexer<Data>::destroyAll() {
+	if constexpr (!std::is_trivially_destructible_v<Data>) {
+		for (auto i = _first; i != _capacity; i = findOccupied(_occupied, i + 1, _capacity)) {
+			_nodes[i].data.~Data();
 		}
-	} else {
-		_nodes = nullptr;
-		_freeNode = nullindex;
 	}
 }
 
 template<class Data>
-Indexer<Data>::~Indexer() {
-	for (uint i = 0; i != _capacity; ++i) {
-		auto& node = _nodes[i];
-		if (node.free) {
-			continue;
-		}
-		node.data.~Data();
+Indexer<Data>::Indexer(const Indexer& other):
+    _nodes(nullptr), _occupied(nullptr), _wordsCount(0), _capacity(0), _count(0), _freeNode(nullindex), _first(0),
+    _resource(other._resource) {
+	if (other._capacity && relocate(other._capacity)) {
+		copySlots(other);
+	}
+}
+
+template<class Data>
+Indexer<Data>& Indexer<Data>::operator=(const Indexer& other) {
+	if (this == &other) {
+		return *this;
+	}
+
+	destroyAll();
+	if (_capacity != other._capacity) {
+		relocate(0);
+	}
+	for (uint i = 0; i != _wordsCount; ++i) {
+		_occupied[i] = 0;
+	}
+	_count = 0;
+	_freeNode = nullindex;
+	_first = _capacity;
+
+	if (other._capacity && (_capacity == other._capacity || relocate(other._capacity))) {
+		copySlots(other);
+	}
+
+	return *this;
+}
+
+template<class Data>
+void Indexer<Data>::copySlots(const Indexer& other) {
+	assert(_capacity == other._capacity && _wordsCount >= wordsCount(_capacity));
+
+	const auto count = wordsCount(_capacity);
+	std::memcpy(_occupied, other._occupied, count * sizeof(Word));
+	for (auto i = count; i != _wordsCount; ++i) {
+		_occupied[i] = 0;
 	}
 
-	if (_capacity) {
-		free(_nodes);
+	if constexpr (std::is_trivially_copyable_v<Data>) {
+		std::memcpy(_nodes, other._nodes, _capacity * sizeof(Node));
+	} else {
+		for (uint i = 0; i != _capacity; ++i) {
+			if (isOccupied(_occupied, i)) {
+				new (&_nodes[i].data) Data(other._nodes[i].data);
+			} else {
+				_nodes[i].next = other._nodes[i].next;
+			}
+		}
 	}
+
+	_count = other._count;
+	_freeNode = other._freeNode;
+	_first = other._first;
 }
 
 template<class Data>
 void Indexer<Data>::remove(Indexer::index_t idx) {
-	assert(idx < _capacity && !_nodes[idx].free);
+	assert(contains(idx));
 
 	auto& node = _nodes[idx];
 	node.data.~Data();
 	node.next = _freeNode;
-	node.free = 1;
+	_occupied[idx / WORD_BITS] &= ~(Word(1) << (idx % WORD_BITS));
 	_freeNode = idx;
 	--_count;
+
+	if (idx == _first) {
+		_first = findOccupied(_occupied, idx + 1, _capacity);
+	}
 }
 
 template<class Data>
 template<class... Args>
 typename Indexer<Data>::index_t Indexer<Data>::emplace(Args&&... args) {
 	if (_freeNode == nullindex) {
-		const auto newCapacity = (_capacity ? _capacity : 8) * 2;
-		auto newNodes = static_cast<Node*>(std::malloc(newCapacity * sizeof(Node)));
+		if (!grow((_capacity ? _capacity : 8) * 2)) {
+			return nullindex;
+		}
+	}
+
+	auto& node = _nodes[_freeNode];
+	index_t newIdx = _freeNode;
+	_freeNode = node.next;
+	_occupied[newIdx / WORD_BITS] |= Word(1) << (newIdx % WORD_BITS);
+	++_count;
+
+	new (&node.data) Data(std::forward<Args>(args)...);
+	if (newIdx < _first) {
+		_first = newIdx;
+	}
+
+	return newIdx;
+}
+
+template<class Data>
+bool Indexer<Data>::grow(uint newCapacity) {
+	// nullindex terminates the free list, it can't be a valid index
+	if (newCapacity > uint(nullindex)) {
+		newCapacity = nullindex;
+	}
+	if (newCapacity <= _capacity) {
+		return false;
+	}
+
+	const auto oldCapacity = _capacity;
+	if (!relocate(newCapacity)) {
+		return false;
+	}
+
+	// New slots are prepended to the free list in index order
+	for (uint i = oldCapacity; i != newCapacity - 1; ++i) {
+		_nodes[i].next = i + 1;
+	}
+	_nodes[newCapacity - 1].next = _freeNode;
+
+	_freeNode = oldCapacity;
+	if (_count == 0) {
+		_first = _capacity;
+	}
+
+	return true;
+}
+
+template<class Data>
+void* Indexer<Data>::allocate(std::size_t size) {
+	if (!_resource) {
+		return std::malloc(size);
+	}
+	try {
+		return _resource->allocate(size, ALIGNMENT);
+	} catch (const std::bad_alloc&) {
+		return nullptr;
+	}
+}
+
+template<class Data>
+void Indexer<Data>::deallocate(void* ptr, std::size_t size) {
+	if (!_resource) {
+		std::free(ptr);
+	} else if (ptr) {
+		_resource->deallocate(ptr, size, ALIGNMENT);
+	}
+}
 
+template<class Data>
+void* Indexer<Data>::reallocate(void* ptr, std::size_t oldSize, std::size_t newSize) {
+	if (!_resource) {
+		return std::realloc(ptr, newSize);
+	}
+
+	// Resources can't resize in place
+	auto newPtr = allocate(newSize);
+	if (newPtr && ptr) {
+		std::memcpy(newPtr, ptr, oldSize < newSize ? oldSize : newSize);
+		deallocate(ptr, oldSize);
+	}
+
+	return newPtr;
+}
+
+template<class Data>
+bool Indexer<Data>::relocate(uint newCapacity) {
+	if (newCapacity == 0) {
+		deallocate(_nodes, _capacity * sizeof(Node));
+		deallocate(_occupied, _wordsCount * sizeof(Word));
+		_nodes = nullptr;
+		_occupied = nullptr;
+		_wordsCount = 0;
+		_capacity = 0;
+
+		return true;
+	}
+
+	// Bitmap grows first and shrinks last, so it always covers the current capacity
+	const auto oldWordsCount = _wordsCount;
+	const auto newWordsCount = wordsCount(newCapacity);
+	if (newWordsCount > oldWordsCount) {
+		auto newOccupied =
+		    static_cast<Word*>(reallocate(_occupied, oldWordsCount * sizeof(Word), newWordsCount * sizeof(Word)));
+		if (!newOccupied) {
+			return false;
+		}
+		for (auto i = oldWordsCount; i != newWordsCount; ++i) {
+			newOccupied[i] = 0;
+		}
+		_occupied = newOccupied;
+		_wordsCount = newWordsCount;
+	}
+
+	// Trivially copyable data can be moved bitwise, realloc may even extend the block in place
+	if constexpr (std::is_trivially_copyable_v<Data>) {
+		auto newNodes = static_cast<Node*>(reallocate(_nodes, _capacity * sizeof(Node), newCapacity * sizeof(Node)));
 		if (!newNodes) {
-			return nullindex;
+			return false;
+		}
+		_nodes = newNodes;
+	} else {
+		auto newNodes = static_cast<Node*>(allocate(newCapacity * sizeof(Node)));
+		if (!newNodes) {
+			return false;
 		}
 
-		for (uint i = 0; i != _capacity; ++i) {
+		const auto count = _capacity < newCapacity ? _capacity : newCapacity;
+		for (uint i = 0; i != count; ++i) {
 			Node& node = _nodes[i];
 			Node& newNode = newNodes[i];
-			newNode.free = node.free;
-			newNode.next = node.next;
+			if (!isOccupied(_occupied, i)) {
+				newNode.next = node.next;
+				continue;
+			}
 			if constexpr (std::is_nothrow_move_constructible_v<Data>) {
 				new ((void*)&newNode.data) Data(std::move(node.data));
 			} else {
@@ -207,30 +429,59 @@ typename Indexer<Data>::index_t Indexer<Data>::emplace(Args&&... args) {
 			}
 			node.data.~Data();
 		}
+		deallocate(_nodes, _capacity * sizeof(Node));
 		_nodes = newNodes;
-
-		for (uint i = _capacity; i != newCapacity - 1; ++i) {
-			auto& node = _nodes[i];
-			node.next = i + 1;
-			node.free = 1;
+	}
+	_capacity = newCapacity;
+
+	if (newWordsCount < oldWordsCount) {
+		// Keep the larger block if shrinking fails
+		if (auto newOccupied = static_cast<Word*>(
+		        reallocate(_occupied, oldWordsCount * sizeof(Word), newWordsCount * sizeof(Word)))) {
+			_occupied = newOccupied;
+			_wordsCount = newWordsCount;
 		}
-		auto& node = _nodes[newCapacity - 1];
-		node.next = nullindex;
-		node.free = 1;
+	}
+
+	return true;
+}
+
+template<class Data>
+bool Indexer<Data>::reserve(uint capacity) {
+	if (capacity <= _capacity) {
+		return true;
+	}
 
-		_freeNode = _capacity;
-		_capacity = newCapacity;
+	return grow(capacity);
+}
+
+template<class Data>
+bool Indexer<Data>::shrinkToFit() {
+	uint newCapacity = _capacity;
+	while (newCapacity != 0 && !isOccupied(_occupied, newCapacity - 1)) {
+		--newCapacity;
+	}
+	if (newCapacity == _capacity) {
+		return true;
 	}
 
-	auto& node = _nodes[_freeNode];
-	index_t newIdx = _freeNode;
-	_freeNode = node.next;
-	node.free = 0;
-	++_count;
+	if (!relocate(newCapacity)) {
+		return false;
+	}
 
-	new (&node.data) Data(std::forward<Args>(args)...);
+	// Relink the free list without released slots, lowest indices first
+	_freeNode = nullindex;
+	for (uint i = newCapacity; i-- != 0;) {
+		if (!isOccupied(_occupied, i)) {
+			_nodes[i].next = _freeNode;
+			_freeNode = i;
+		}
+	}
+	if (_count == 0) {
+		_first = _capacity;
+	}
 
-	return newIdx;
+	return true;
 }
 
 template<class Data>
@@ -254,28 +505,47 @@ Data& Indexer<Data>::operator[](Indexer::index_t idx) {
 
 template<class Data>
 typename Indexer<Data>::Iterator Indexer<Data>::begin() const {
-	for (uint i = 0; i != _capacity; ++i) {
-		if (!_nodes[i].free) {
-			return Indexer::Iterator(_nodes, _nodes + i, _nodes + _capacity);
-		}
-	}
+	return Indexer::Iterator(_nodes, _nodes + _first, _nodes + _capacity, _occupied);
+}
 
-	return end();
+template<class Data>
+typename Indexer<Data>::Iterator Indexer<Data>::iteratorAt(Indexer::index_t idx) const {
+	assert(contains(idx));
+
+	return Indexer::Iterator(_nodes, _nodes + idx, _nodes + _capacity, _occupied);
 }
 
 template<class Data>
 typename Indexer<Data>::Iterator Indexer<Data>::end() const {
 	const auto end = _nodes + _capacity;
-	return Indexer::Iterator(_nodes, end, end);
+	return Indexer::Iterator(_nodes, end, end, _occupied);
 }
 
 template<class Data>
 Indexer<Data>::Indexer(Indexer&& other) noexcept:
-    _capacity(other._capacity), _freeNode(other._freeNode), _nodes(other._nodes), _count(other._count) {
+    _nodes(other._nodes), _occupied(other._occupied), _wordsCount(other._wordsCount), _capacity(other._capacity),
+    _count(other._count), _freeNode(other._freeNode), _first(other._first), _resource(other._resource) {
 	other._capacity = 0;
 	other._nodes = nullptr;
+	other._occupied = nullptr;
+	other._wordsCount = 0;
 	other._freeNode = nullindex;
 	other._count = 0;
+	other._first = 0;
+}
+
+template<class Data>
+Indexer<Data>& Indexer<Data>::operator=(Indexer&& other) noexcept {
+	std::swap(_nodes, other._nodes);
+	std::swap(_occupied, other._occupied);
+	std::swap(_wordsCount, other._wordsCount);
+	std::swap(_capacity, other._capacity);
+	std::swap(_count, other._count);
+	std::swap(_freeNode, other._freeNode);
+	std::swap(_first, other._first);
+	std::swap(_resource, other._resource);
+
+	return *this;
 }
 
 template<class Data>
@@ -298,7 +568,31 @@ void Indexer<Data>::remove(const Indexer::Iterator& iterator) {
 
 template<class Data>
 bool Indexer<Data>::contains(Indexer::index_t idx) const {
-	return idx < _capacity && !_nodes[idx].free;
+	return idx < _capacity && isOccupied(_occupied, idx);
+}
+
+template<class Data>
+uint Indexer<Data>::findOccupied(const Word* occupied, uint idx, uint capacity) {
+	if (idx >= capacity) {
+		return capacity;
+	}
+
+	// Skip whole words of free slots, bits past capacity are 0 so the last word needs no masking
+	auto wordIdx = idx / WORD_BITS;
+	auto word = occupied[wordIdx] >> (idx % WORD_BITS);
+	if (word) {
+		return idx + std::countr_zero(word);
+	}
+
+	const auto count = wordsCount(capacity);
+	while (++wordIdx < count) {
+		word = occupied[wordIdx];
+		if (word) {
+			return wordIdx * WORD_BITS + std::countr_zero(word);
+		}
+	}
+
+	return capacity;
 }
 
 template<class Data>
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "typedefs.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace biss {
+
+// Minimal fork-join pool for batched tree operations.
+// Workers pull chunks of the index range from a shared counter, so a worker that is done early keeps
+// taking work from the rest of the range. The calling thread takes part as worker 0.
+//
+// Anything with the same workersCount() / parallelFor() interface can be used as an executor instead.
+class ThreadPool {
+  public:
+	// threadsCount additional threads are started, 0 runs everything on the calling thread
+	explicit ThreadPool(uint threadsCount = defaultThreadsCount());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	uint workersCount() const { return _threads.size() + 1; }
+
+	// One thread less than hardware threads, the calling thread is a worker too
+	static uint defaultThreadsCount() {
+		const uint count = std::thread::hardware_concurrency();
+		return count > 1 ? count - 1 : 0;
+	}
+
+	// Call f(worker, i) for every i in [0, count), worker is in [0, workersCount()).
+	// Blocks until all calls are done. f must not throw.
+	// Calls made from inside f run inline on the calling worker with its worker index.
+	template<class F>
+	void parallelFor(uint count, uint chunkSize, const F& f);
+
+  private:
+	// Pool and worker index of the calling thread while it runs jobs of a pool
+	struct Current {
+		const ThreadPool* pool = nullptr;
+		uint worker = 0;
+	};
+	static Current& current() {
+		thread_local Current current;
+		return current;
+	}
+
+	void loop(uint worker);
+	void work(uint worker);
+
+  private:
+	struct Job {
+		void (*call)(const void* f, uint worker, uint i);
+		const void* f;
+		uint count;
+		uint chunkSize;
+		std::atomic<uint> next;
+	};
+
+	std::vector<std::thread> _threads;
+
+	std::mutex _submitMutex;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _done;
+	uint _generation = 0;
+	uint _active = 0;
+	bool _stop = false;
+
+	Job _job;
+};
+
+inline ThreadPool::ThreadPool(uint threadsCount) {
+	_threads.reserve(threadsCount);
+	for (uint i = 0; i != threadsCount; ++i) {
+		_threads.emplace_back(&ThreadPool::loop, this, i + 1);
+	}
+}
+
+inline ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard lock(_mutex);
+		_stop = true;
+	}
+	_wake.notify_all();
+
+	for (auto& thread : _threads) {
+		thread.join();
+	}
+}
+
+inline void ThreadPool::loop(uint worker) {
+	current() = Current{this, worker};
+
+	uint generation = 0;
+	while (true) {
+		{
+			std::unique_lock lock(_mutex);
+			_wake.wait(lock, [this, generation] { return _stop || _generation != generation; });
+			if (_stop) {
+				return;
+			}
+			generation = _generation;
+		}
+
+		work(worker);
+
+		{
+			std::lock_guard lock(_mutex);
+			if (--_active == 0) {
+				_done.notify_one();
+			}
+		}
+	}
+}
+
+inline void ThreadPool::work(uint worker) {
+	while (true) {
+		const auto begin = _job.next.fetch_add(_job.chunkSize, std::memory_order_relaxed);
+		if (begin >= _job.count) {
+			return;
+		}
+
+		const auto end = begin + _job.chunkSize < _job.count ? begin + _job.chunkSize : _job.count;
+		for (auto i = begin; i != end; ++i) {
+			_job.call(_job.f, worker, i);
+		}
+	}
+}
+
+template<class F>
+void ThreadPool::parallelFor(uint count, uint chunkSize, const F& f) {
+	if (chunkSize == 0) {
+		chunkSize = 1;
+	}
+
+	// Nested call, the job of the outer call holds all workers
+	const auto caller = current();
+	if (caller.pool == this) {
+		for (uint i = 0; i != count; ++i) {
+			f(caller.worker, i);
+		}
+		return;
+	}
+
+	if (_threads.empty() || count <= chunkSize) {
+		for (uint i = 0; i != count; ++i) {
+			f(uint(0), i);
+		}
+		return;
+	}
+
+	std::lock_guard submitLock(_submitMutex);
+
+	_job.call = [](const void* f, uint worker, uint i) { (*static_cast<const F*>(f))(worker, i); };
+	_job.f = &f;
+	_job.count = count;
+	_job.chunkSize = chunkSize;
+	_job.next.store(0, std::memory_order_relaxed);
+
+	{
+		std::lock_guard lock(_mutex);
+		_active = _threads.size();
+		++_generation;
+	}
+	_wake.notify_all();
+
+	current() = Current{this, 0};
+	work(0);
+	current() = caller;
+
+	std::unique_lock lock(_mutex);
+	_done.wait(lock, [this] { return _active == 0; });
+}
+
+} // namespace biss
@@ -1,11 +1,25 @@
 #pragma once
 
+#include <cstdint>
+
+// Type of node and object indices. 32 bits keep nodes small, define it as std::uint64_t
+// before including the library for trees with more than 2^31 nodes.
+#ifndef AABB_TREE_INDEX_TYPE
+#define AABB_TREE_INDEX_TYPE std::uint32_t
+#endif
+
+// Define as 1 before including the library to count query steps, rotations and update() early returns,
+// see AABBTree::stats(). Counting compiles to nothing when it is 0.
+#ifndef AABB_TREE_STATS
+#define AABB_TREE_STATS 0
+#endif
+
 namespace biss {
 
 
 using uint = unsigned long;
-using index_t = uint;
+using index_t = AABB_TREE_INDEX_TYPE;
 
-constexpr uint nullindex = uint(-1) >> 1;
+constexpr index_t nullindex = index_t(-1) >> 1;
 
 } // namespace biss
\ No newline at end of file
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "aabb_tree.hpp"
+
+#include <limits>
+#include <vector>
+
+namespace biss {
+
+// Read-only snapshot of AABBTree collapsed into Width-ary nodes.
+// Child bounds of a node are stored as structure of arrays, so one node is tested against a query
+// with a handful of vector instructions for all Width children at once.
+// Snapshot doesn't follow changes of the source tree, reported indices are leaf indices of the source tree.
+template<class ValueType, uint N, class KeyElementType, uint Width = 4>
+class WideAABBTree {
+  public:
+	using Tree = AABBTree<ValueType, N, KeyElementType>;
+	using AABB_t = typename Tree::AABB_t;
+
+	explicit WideAABBTree(const Tree& tree);
+
+	// callback(index_t) -> bool, return false to stop
+	template<typename T>
+	void query(const AABB_t& aabb, const T& callback) const;
+	template<class AABBType, typename T>
+	void query(const AABBType& aabb, const T& callback) const;
+
+	uint nodesCount() const { return _nodes.size(); }
+
+  private:
+	// Set in child index for leaves of the source tree
+	static constexpr index_t LEAF_BIT = ~nullindex;
+
+	struct alignas(Width * sizeof(KeyElementType) >= 32 ? 32 : 16) Node {
+		KeyElementType lb[N][Width];
+		KeyElementType ub[N][Width];
+		index_t child[Width];
+	};
+
+  private:
+	std::vector<Node> _nodes;
+};
+
+template<class ValueType, uint N, class KeyElementType, uint Width>
+WideAABBTree<ValueType, N, KeyElementType, Width>::WideAABBTree(const Tree& tree) {
+	static_assert(Width >= 2);
+
+	if (tree._root == nullindex) {
+		return;
+	}
+
+	_nodes.reserve(tree._nodes.count() / (Width - 1) + 1);
+
+	struct Task {
+		index_t source;
+		index_t target;
+	};
+	GrowableStack<Task, 64> stack;
+
+	_nodes.emplace_back();
+	stack.push(Task{tree._root, 0});
+	while (stack.count() > 0) {
+		const auto task = stack.pop();
+
+		// Open up the largest internal node until Width children are gathered
+		index_t children[Width];
+		uint count = 1;
+		children[0] = task.source;
+		while (count < Width) {
+			uint largest = count;
+			for (uint i = 0; i != count; ++i) {
+				const auto& node = tree._nodes[children[i]];
+				if (!node.isLeaf() &&
+				    (largest == count || node.aabb.area() > tree._nodes[children[largest]].aabb.area())) {
+					largest = i;
+				}
+			}
+			if (largest == count) {
+				break;
+			}
+
+			const auto& node = tree._nodes[children[largest]];
+			children[largest] = node.child1;
+			children[count++] = node.child2;
+		}
+
+		for (uint lane = 0; lane != Width; ++lane) {
+			if (lane >= count) {
+				// Empty bounds never intersect anything
+				for (uint axis = 0; axis != N; ++axis) {
+					_nodes[task.target].lb[axis][lane] = std::numeric_limits<KeyElementType>::max();
+					_nodes[task.target].ub[axis][lane] = std::numeric_limits<KeyElementType>::lowest();
+				}
+				_nodes[task.target].child[lane] = nullindex;
+				continue;
+			}
+
+			const auto& source = tree._nodes[children[lane]];
+			for (uint axis = 0; axis != N; ++axis) {
+				_nodes[task.target].lb[axis][lane] = source.aabb.lb.point[axis];
+				_nodes[task.target].ub[axis][lane] = source.aabb.ub.point[axis];
+			}
+
+			if (source.isLeaf()) {
+				_nodes[task.target].child[lane] = children[lane] | LEAF_BIT;
+			} else {
+				const index_t target = _nodes.size();
+				_nodes.emplace_back();
+				_nodes[task.target].child[lane] = target;
+				stack.push(Task{children[lane], target});
+			}
+		}
+	}
+}
+
+template<class ValueType, uint N, class KeyElementType, uint Width>
+template<class AABBType, typename T>
+void WideAABBTree<ValueType, N, KeyElementType, Width>::query(const AABBType& uaabb, const T& callback) const {
+	AABB_t aabb;
+	aabb.set(uaabb);
+	query(aabb, callback);
+}
+
+template<class ValueType, uint N, class KeyElementType, uint Width>
+template<typename T>
+void WideAABBTree<ValueType, N, KeyElementType, Width>::query(const AABB_t& aabb, const T& callback) const {
+	if (_nodes.empty()) {
+		return;
+	}
+
+	GrowableStack<index_t, 256> stack;
+	stack.push(0);
+
+	while (stack.count() > 0) {
+		const Node& node = _nodes[stack.pop()];
+
+		// Branch-free over lanes, compilers turn it into packed compares
+		int hit[Width];
+		for (uint lane = 0; lane != Width; ++lane) {
+			hit[lane] = 1;
+		}
+		for (uint axis = 0; axis != N; ++axis) {
+			const auto lb = aabb.lb.point[axis];
+			const auto ub = aabb.ub.point[axis];
+			for (uint lane = 0; lane != Width; ++lane) {
+				hit[lane] &= (node.lb[axis][lane] <= ub) & (node.ub[axis][lane] >= lb);
+			}
+		}
+
+		for (uint lane = 0; lane != Width; ++lane) {
+			const auto child = node.child[lane];
+			if (!hit[lane] || child == nullindex) {
+				continue;
+			}
+
+			if (child & LEAF_BIT) {
+				if (!callback(child & ~LEAF_BIT)) {
+					return;
+				}
+			} else {
+				stack.push(child);
+			}
+		}
+	}
+}
+
+} // namespace biss
@@ -1,6 +1,17 @@
 #include <aabb_tree.hpp>
+#include <aabb_tree_snapshots.hpp>
+#include <aabb_tree_view.hpp>
 #include <catch2/catch.hpp>
+#include <dual_aabb_tree.hpp>
+#include <frozen_aabb_tree.hpp>
 #include <indexer.hpp>
+#include <atomic>
+#include <filesystem>
+#include <memory_resource>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <wide_aabb_tree.hpp>
 #include <vector>
 
 using namespace Catch::literals;
@@ -35,6 +46,30 @@ class BarMove {
 	OpsCount& o;
 };
 
+// Forwards to the default resource and counts live blocks and bytes
+class CountingResource: public std::pmr::memory_resource {
+  public:
+	int blocks = 0;
+	std::size_t bytes = 0;
+	int allocations = 0;
+
+  private:
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+		++blocks;
+		++allocations;
+		this->bytes += bytes;
+		return std::pmr::get_default_resource()->allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+		--blocks;
+		this->bytes -= bytes;
+		std::pmr::get_default_resource()->deallocate(p, bytes, alignment);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
 struct Vec2f {
 	float x;
 	float y;
@@ -205,6 +240,224 @@ TEST_CASE("Index", "[Index]") {
 
 		REQUIRE(saveCapacity == index.capacity());
 	}
+	SECTION("Reserve and shrink") {
+		Indexer<int> index;
+		REQUIRE(index.reserve(100));
+		REQUIRE(index.capacity() == 100);
+		for (int i = 0; i != 100; ++i) {
+			index.emplace(i);
+		}
+		REQUIRE(index.capacity() == 100);
+
+		for (int i = 50; i != 100; ++i) {
+			index.remove(i);
+		}
+		index.remove(10);
+		REQUIRE(index.shrinkToFit());
+		REQUIRE(index.capacity() == 50);
+		REQUIRE(index.count() == 49);
+		for (int i = 0; i != 50; ++i) {
+			REQUIRE(index.contains(i) == (i != 10));
+		}
+
+		// Freed slots are reused before growing again
+		REQUIRE(index.emplace(10) == 10);
+		REQUIRE(index.capacity() == 50);
+		index.emplace(50);
+		REQUIRE(index.capacity() > 50);
+		for (int i = 0; i != 51; ++i) {
+			REQUIRE(index[i] == i);
+		}
+	}
+	SECTION("Shrink moves elements") {
+		OpsCount ops;
+		{
+			Indexer<BarMove> index;
+			for (int i = 0; i != 20; ++i) {
+				index.emplace(ops);
+			}
+			for (int i = 5; i != 20; ++i) {
+				index.remove(i);
+			}
+			REQUIRE(index.shrinkToFit());
+			REQUIRE(index.capacity() == 5);
+			REQUIRE(index.count() == 5);
+		}
+		REQUIRE(ops.construct + ops.move_construct == ops.destruct);
+	}
+	SECTION("Iterate over sparse index") {
+		Indexer<int> index;
+		for (int i = 0; i != 1000; ++i) {
+			index.emplace(i);
+		}
+
+		std::set<int> alive;
+		for (int i = 0; i != 1000; ++i) {
+			if (rand() % 10 < 7) {
+				index.remove(i);
+			} else {
+				alive.insert(i);
+			}
+		}
+
+		std::set<int> visited;
+		for (auto it = index.begin(); it != index.end(); ++it) {
+			REQUIRE(*it == int(it.idx()));
+			visited.insert(*it);
+		}
+		REQUIRE(visited == alive);
+
+		for (const auto i : alive) {
+			REQUIRE(index.begin().idx() == index_t(i));
+			index.remove(i);
+		}
+		REQUIRE(index.begin() == index.end());
+
+		index.emplace(5);
+		REQUIRE(*index.begin() == 5);
+	}
+	SECTION("Memory resource") {
+		CountingResource resource;
+		OpsCount ops;
+		{
+			Indexer<BarMove> index(0, &resource);
+			REQUIRE(index.resource() == &resource);
+			REQUIRE(resource.blocks == 0);
+			for (int i = 0; i != 100; ++i) {
+				index.emplace(ops);
+			}
+			REQUIRE(resource.blocks == 2);
+			for (int i = 10; i != 100; ++i) {
+				index.remove(i);
+			}
+			REQUIRE(index.shrinkToFit());
+			REQUIRE(index.capacity() == 10);
+			REQUIRE(resource.blocks == 2);
+			REQUIRE(resource.bytes < 100 * sizeof(BarMove));
+
+			Indexer<BarMove> moved(std::move(index));
+			REQUIRE(moved.resource() == &resource);
+			REQUIRE(moved.count() == 10);
+		}
+		REQUIRE(resource.blocks == 0);
+		REQUIRE(ops.construct + ops.move_construct == ops.destruct);
+
+		CountingResource stackResource;
+		{
+			GrowableStack<int, 4> stack(&stackResource);
+			for (int i = 0; i != 100; ++i) {
+				stack.push(i);
+			}
+			REQUIRE(stack.isHeap());
+			REQUIRE(stackResource.blocks == 1);
+			for (int i = 99; i >= 0; --i) {
+				REQUIRE(stack.pop() == i);
+			}
+		}
+		REQUIRE(stackResource.blocks == 0);
+	}
+	SECTION("Copy") {
+		OpsCount ops;
+		{
+			Indexer<std::string> index;
+			for (int i = 0; i != 200; ++i) {
+				index.emplace(std::to_string(i));
+			}
+			for (int i = 0; i < 200; i += 3) {
+				index.remove(i);
+			}
+
+			Indexer<std::string> copy(index);
+			REQUIRE(copy.count() == index.count());
+			REQUIRE(copy.capacity() == index.capacity());
+			for (auto it = index.begin(); it != index.end(); ++it) {
+				REQUIRE(copy[it.idx()] == *it);
+			}
+			// Free list is copied too, so both hand out the same slots
+			REQUIRE(copy.emplace("a") == index.emplace("a"));
+
+			Indexer<std::string> small;
+			small.emplace("b");
+			small = index;
+			REQUIRE(small.count() == index.count());
+			for (auto it = index.begin(); it != index.end(); ++it) {
+				REQUIRE(small[it.idx()] == *it);
+			}
+
+			Indexer<int> ints;
+			Indexer<int> other;
+			for (int i = 0; i != 100; ++i) {
+				ints.emplace(i);
+				other.emplace(-i);
+			}
+			other.remove(5);
+			ints = other;
+			REQUIRE(ints.count() == 99);
+			REQUIRE(!ints.contains(5));
+			REQUIRE(ints[7] == -7);
+			ints = Indexer<int>();
+			REQUIRE(ints.count() == 0);
+			REQUIRE(ints.begin() == ints.end());
+		}
+	}
+	SECTION("Index type") {
+		// Built with 32 and 64 bit indices, see AABB_TREE_INDEX_TYPE
+		REQUIRE(std::is_unsigned_v<index_t>);
+		REQUIRE(nullindex == std::numeric_limits<index_t>::max() / 2);
+		REQUIRE(index_t(nullindex + 1) == index_t(1) << (sizeof(index_t) * 8 - 1));
+
+		Indexer<int> ints;
+		for (int i = 0; i != 100; ++i) {
+			REQUIRE(ints.emplace(i) != nullindex);
+		}
+		REQUIRE(ints.count() == 100);
+	}
+}
+
+template<biss::uint N, class Type>
+void checkAABBKernels() {
+	// Small coordinates range, so touching and equal bounds happen often
+	const auto random = [] {
+		AABB<N, Type> aabb;
+		for (biss::uint i = 0; i != N; ++i) {
+			aabb.lb.point[i] = Type(rand() % 8);
+			aabb.ub.point[i] = aabb.lb.point[i] + Type(rand() % 4);
+		}
+		return aabb;
+	};
+
+	for (int i = 0; i != 1000; ++i) {
+		const auto a = random();
+		const auto b = random();
+
+		bool intersecting = true;
+		bool contains = true;
+		AABB<N, Type> united;
+		for (biss::uint j = 0; j != N; ++j) {
+			intersecting = intersecting && b.lb.point[j] <= a.ub.point[j] && a.lb.point[j] <= b.ub.point[j];
+			contains = contains && a.lb.point[j] <= b.lb.point[j] && b.ub.point[j] <= a.ub.point[j];
+			united.lb.point[j] = std::min(a.lb.point[j], b.lb.point[j]);
+			united.ub.point[j] = std::max(a.ub.point[j], b.ub.point[j]);
+		}
+
+		REQUIRE(a.isIntersecting(b) == intersecting);
+		REQUIRE(a.contains(b) == contains);
+		const auto result = unite(a, b);
+		for (biss::uint j = 0; j != N; ++j) {
+			REQUIRE(result.lb.point[j] == united.lb.point[j]);
+			REQUIRE(result.ub.point[j] == united.ub.point[j]);
+		}
+	}
+}
+
+TEST_CASE("AABB", "[AABB]") {
+	SECTION("Kernels") {
+		checkAABBKernels<2, float>();
+		checkAABBKernels<3, float>();
+		checkAABBKernels<3, double>();
+		checkAABBKernels<2, int>();
+		checkAABBKernels<4, double>();
+	}
 }
 
 TEST_CASE("AABBTree", "[AABBTree]") {
@@ -362,4 +615,1431 @@ TEST_CASE("AABBTree", "[AABBTree]") {
 			tree.update(idx, aabb, Vec2f{0,0});
 		}
 	}
+	SECTION("Bulk build") {
+		std::vector<std::pair<AABB<2, float>, AABB<2, float>>> objects;
+		for (int i = 0; i != 1000; ++i) {
+			Vec<2, float> lb;
+			lb.point[0] = rand() % 1000;
+			lb.point[1] = rand() % 1000;
+			Vec<2, float> ub;
+			ub.point[0] = lb.point[0] + (rand() % 100);
+			ub.point[1] = lb.point[1] + (rand() % 100);
+
+			objects.emplace_back(AABB<2, float>{lb, ub}, AABB<2, float>{lb, ub});
+		}
+
+		AABBTree<AABB<2, float>, 2, float> tree(objects);
+		REQUIRE(tree.count() == objects.size());
+
+		std::vector<index_t> idxs;
+		tree.build(objects.begin(), objects.end(), std::back_inserter(idxs));
+		REQUIRE(tree.count() == 2 * objects.size());
+		REQUIRE(idxs.size() == objects.size());
+		for (size_t i = 0; i != idxs.size(); ++i) {
+			REQUIRE(tree[idxs[i]].lb.point[0] == objects[i].second.lb.point[0]);
+		}
+
+		AABB<2, float> tester{Vec<2, float>{400}, Vec<2, float>{500}};
+		int count = 0;
+		for (const auto& object : objects) {
+			count += 2 * tester.isIntersecting(object.first);
+		}
+		tree.query(tester, [&count, &tester](auto it) {
+			count -= it->isIntersecting(tester);
+			return true;
+		});
+		REQUIRE(count == 0);
+
+		for (auto idx : idxs) {
+			tree.remove(idx);
+		}
+		tree.emplace(tester, tester);
+		REQUIRE(tree.count() == objects.size() + 1);
+	}
+	SECTION("Bulk build with user aabb") {
+		std::vector<std::pair<AABB2f, int>> objects;
+		for (int i = 0; i != 100; ++i) {
+			objects.emplace_back(AABB2f{Vec2f{float(i), float(i)}, Vec2f{i + 0.5f, i + 0.5f}}, i);
+		}
+
+		AABBTree<int, 2, float> tree;
+		tree.build(objects.begin(), objects.end());
+		REQUIRE(tree.count() == objects.size());
+
+		int hits = 0;
+		tree.query(AABB2f{Vec2f{10.1f, 10.1f}, Vec2f{10.2f, 10.2f}}, [&hits](auto it) {
+			REQUIRE(*it == 10);
+			++hits;
+			return true;
+		});
+		REQUIRE(hits == 1);
+	}
+	SECTION("Batched update") {
+		AABBTree<AABB<2, float>, 2, float> tree(1.0f);
+		std::vector<index_t> idxs;
+		std::vector<AABB<2, float>> aabbs;
+		for (int i = 0; i != 1000; ++i) {
+			Vec<2, float> lb;
+			lb.point[0] = rand() % 1000;
+			lb.point[1] = rand() % 1000;
+			Vec<2, float> ub;
+			ub.point[0] = lb.point[0] + (rand() % 100);
+			ub.point[1] = lb.point[1] + (rand() % 100);
+
+			const auto aabb = AABB<2, float>{lb, ub};
+			idxs.push_back(tree.emplace(aabb, aabb));
+			aabbs.push_back(aabb);
+		}
+
+		AABB<2, float> tester{Vec<2, float>{400}, Vec<2, float>{500}};
+		for (int step = 0; step != 10; ++step) {
+			std::vector<Vec<2, float>> displacements;
+			for (size_t i = 0; i != idxs.size(); ++i) {
+				Vec<2, float> d;
+				d.point[0] = (rand() % 21) - 10;
+				d.point[1] = (rand() % 21) - 10;
+				aabbs[i].lb += d;
+				aabbs[i].ub += d;
+				tree[idxs[i]] = aabbs[i];
+				displacements.push_back(d);
+			}
+			// Only part of objects moves
+			const auto moved = idxs.size() / (step % 3 + 1);
+			tree.updateMany(std::span(idxs.data(), moved), std::span(aabbs.data(), moved),
+			    std::span(displacements.data(), moved));
+			for (size_t i = moved; i != idxs.size(); ++i) {
+				tree.update(idxs[i], aabbs[i]);
+			}
+
+			int count = 0;
+			for (const auto& aabb : aabbs) {
+				count += tester.isIntersecting(aabb);
+			}
+			tree.query(tester, [&count, &tester](auto it) {
+				count -= it->isIntersecting(tester);
+				return true;
+			});
+			REQUIRE(count == 0);
+		}
+		tree.updateMany(idxs, aabbs);
+		REQUIRE(tree.count() == idxs.size());
+		// Heights are recomputed for every node marked by the batched refit
+		REQUIRE(tree.stats().height <= 30);
+	}
+	SECTION("Overlapping pairs") {
+		AABBTree<AABB<2, float>, 2, float> tree;
+		std::vector<index_t> idxs;
+		std::vector<AABB<2, float>> aabbs;
+		for (int i = 0; i != 300; ++i) {
+			Vec<2, float> lb;
+			lb.point[0] = rand() % 1000;
+			lb.point[1] = rand() % 1000;
+			Vec<2, float> ub;
+			ub.point[0] = lb.point[0] + (rand() % 100);
+			ub.point[1] = lb.point[1] + (rand() % 100);
+
+			const auto aabb = AABB<2, float>{lb, ub};
+			idxs.push_back(tree.emplace(aabb, aabb));
+			aabbs.push_back(aabb);
+		}
+
+		const auto bruteForce = [&aabbs](const std::vector<bool>& moved) {
+			std::set<std::pair<size_t, size_t>> pairs;
+			for (size_t i = 0; i != aabbs.size(); ++i) {
+				for (size_t j = i + 1; j != aabbs.size(); ++j) {
+					if ((moved[i] || moved[j]) && aabbs[i].isIntersecting(aabbs[j])) {
+						pairs.emplace(i, j);
+					}
+				}
+			}
+			return pairs;
+		};
+		const auto collect = [&idxs](std::set<std::pair<size_t, size_t>>& pairs) {
+			return [&idxs, &pairs](index_t a, index_t b) {
+				auto i = std::find(idxs.begin(), idxs.end(), a) - idxs.begin();
+				auto j = std::find(idxs.begin(), idxs.end(), b) - idxs.begin();
+				REQUIRE(pairs.emplace(std::min(i, j), std::max(i, j)).second);
+				return true;
+			};
+		};
+
+		std::set<std::pair<size_t, size_t>> pairs;
+		tree.queryPairs(collect(pairs));
+		REQUIRE(pairs == bruteForce(std::vector<bool>(aabbs.size(), true)));
+
+		std::set<std::pair<size_t, size_t>> movedPairs;
+		tree.queryMovedPairs(collect(movedPairs));
+		REQUIRE(movedPairs == pairs);
+
+		movedPairs.clear();
+		tree.queryMovedPairs(collect(movedPairs));
+		REQUIRE(movedPairs.empty());
+
+		std::vector<bool> moved(aabbs.size(), false);
+		for (size_t i = 0; i < aabbs.size(); i += 7) {
+			aabbs[i].lb += Vec<2, float>{50};
+			aabbs[i].ub += Vec<2, float>{50};
+			tree.update(idxs[i], aabbs[i]);
+			moved[i] = true;
+		}
+		tree.remove(idxs.back());
+		idxs.pop_back();
+		aabbs.pop_back();
+		moved.pop_back();
+
+		tree.queryMovedPairs(collect(movedPairs));
+		REQUIRE(movedPairs == bruteForce(moved));
+	}
+	SECTION("Raycast") {
+		AABBTree<int, 2, float> tree;
+		// 10x10 grid of unit boxes with 1 unit gaps
+		for (int x = 0; x != 10; ++x) {
+			for (int y = 0; y != 10; ++y) {
+				const Vec<2, float> lb(2.0f * x, 2.0f * y);
+				tree.emplace(AABB<2, float>{lb, lb + Vec<2, float>{1}}, 10 * x + y);
+			}
+		}
+
+		// All hits along the row y = 3
+		std::set<int> hits;
+		tree.raycast(Vec<2, float>(-1, 6.5f), Vec<2, float>(100, 0), 1.0f, [&tree, &hits](index_t idx, float fraction) {
+			REQUIRE(fraction >= 0.f);
+			REQUIRE(fraction <= 1.f);
+			REQUIRE(tree[idx] % 10 == 3);
+			hits.insert(tree[idx]);
+			return 1.0f;
+		});
+		REQUIRE(hits.size() == 10);
+
+		// Diagonal ray between boxes misses everything
+		int calls = 0;
+		tree.raycast(Vec<2, float>(1.5f, -1), Vec<2, float>(0, 100), 1.0f, [&calls](index_t, float) {
+			++calls;
+			return 1.0f;
+		});
+		REQUIRE(calls == 0);
+
+		// Closest hit
+		int closest = -1;
+		float closestFraction = 1.0f;
+		tree.raycast(Vec<2, float>(25, 6.5f), Vec<2, float>(-100, 0), 1.0f,
+		    [&tree, &closest, &closestFraction](index_t idx, float fraction) {
+			    if (fraction < closestFraction) {
+				    closest = tree[idx];
+				    closestFraction = fraction;
+			    }
+			    return fraction;
+		    });
+		REQUIRE(closest == 93);
+		REQUIRE(closestFraction == Approx(0.06f));
+
+		// Any hit
+		calls = 0;
+		tree.raycast(Vec<2, float>(-1, 6.5f), Vec<2, float>(100, 0), 1.0f, [&calls](index_t, float) {
+			++calls;
+			return 0.0f;
+		});
+		REQUIRE(calls == 1);
+
+		// Short segment
+		hits.clear();
+		tree.raycast(Vec<2, float>(-1, 6.5f), Vec<2, float>(100, 0), 0.045f, [&tree, &hits](index_t idx, float) {
+			hits.insert(tree[idx]);
+			return 1.0f;
+		});
+		REQUIRE(hits == std::set<int>{3, 13});
+	}
+	SECTION("Nearest") {
+		AABBTree<AABB<2, float>, 2, float> tree;
+		std::vector<AABB<2, float>> aabbs;
+		for (int i = 0; i != 500; ++i) {
+			Vec<2, float> lb;
+			lb.point[0] = rand() % 1000;
+			lb.point[1] = rand() % 1000;
+			Vec<2, float> ub;
+			ub.point[0] = lb.point[0] + (rand() % 10);
+			ub.point[1] = lb.point[1] + (rand() % 10);
+
+			const auto aabb = AABB<2, float>{lb, ub};
+			tree.emplace(aabb, aabb);
+			aabbs.push_back(aabb);
+		}
+
+		const Vec<2, float> point(500, 500);
+		std::vector<float> distances;
+		for (const auto& aabb : aabbs) {
+			distances.push_back(aabb.sqDistance(AABB<2, float>{point, point}));
+		}
+		std::sort(distances.begin(), distances.end());
+
+		std::vector<float> found;
+		tree.nearest(point, 10, [&tree, &found, &point](index_t idx, float sqDistance) {
+			REQUIRE(tree[idx].sqDistance(AABB<2, float>{point, point}) == sqDistance);
+			found.push_back(sqDistance);
+			return true;
+		});
+		REQUIRE(found == std::vector<float>(distances.begin(), distances.begin() + 10));
+
+		// Cut off by distance
+		const auto maxDistance = std::sqrt(distances[3]) + 0.01f;
+		found.clear();
+		tree.nearest(
+		    AABB<2, float>{point, point}, 10,
+		    [&found](index_t, float sqDistance) {
+			    found.push_back(sqDistance);
+			    return true;
+		    },
+		    maxDistance);
+		REQUIRE(found == std::vector<float>(distances.begin(), distances.begin() + 4));
+	}
+	SECTION("Nearest with integer keys") {
+		AABBTree<int, 3, int> tree;
+		for (int i = 0; i != 10; ++i) {
+			Vec<3, int> lb(i * 10);
+			tree.emplace(AABB<3, int>{lb, lb + Vec<3, int>(1)}, i);
+		}
+
+		std::vector<int> found;
+		tree.nearest(Vec<3, int>(32), 3, [&tree, &found](index_t idx, double) {
+			found.push_back(tree[idx]);
+			return true;
+		});
+		REQUIRE(found == std::vector<int>{3, 4, 2});
+	}
+	SECTION("Wide tree") {
+		AABBTree<AABB<2, float>, 2, float> tree;
+		for (int i = 0; i != 1000; ++i) {
+			Vec<2, float> lb;
+			lb.point[0] = rand() % 1000;
+			lb.point[1] = rand() % 1000;
+			Vec<2, float> ub;
+			ub.point[0] = lb.point[0] + (rand() % 100);
+			ub.point[1] = lb.point[1] + (rand() % 100);
+
+			tree.emplace(AABB<2, float>{lb, ub}, AABB<2, float>{lb, ub});
+		}
+
+		const WideAABBTree<AABB<2, float>, 2, float, 4> wide4(tree);
+		const WideAABBTree<AABB<2, float>, 2, float, 8> wide8(tree);
+		REQUIRE(wide8.nodesCount() < wide4.nodesCount());
+
+		for (int i = 0; i != 10; ++i) {
+			AABB<2, float> tester{Vec<2, float>(100 * i), Vec<2, float>(100 * i + 50)};
+			std::set<index_t> expected;
+			tree.query(tester, [&expected](auto it) {
+				expected.insert(it.idx());
+				return true;
+			});
+
+			std::set<index_t> found4;
+			wide4.query(tester, [&found4, &tree, &tester](index_t idx) {
+				REQUIRE(tree[idx].isIntersecting(tester));
+				found4.insert(idx);
+				return true;
+			});
+			std::set<index_t> found8;
+			wide8.query(tester, [&found8](index_t idx) {
+				found8.insert(idx);
+				return true;
+			});
+			REQUIRE(found4.size() == expected.size());
+			REQUIRE(found8 == found4);
+		}
+
+		const WideAABBTree<int, 2, float> empty(AABBTree<int, 2, float>{});
+		empty.query(AABB<2, float>{Vec<2, float>(0), Vec<2, float>(1)}, [](index_t) {
+			REQUIRE(false);
+			return true;
+		});
+	}
+	SECTION("Batch query") {
+		AABBTree<AABB<2, float>, 2, float> tree;
+		for (int i = 0; i != 1000; ++i) {
+			Vec<2, float> lb;
+			lb.point[0] = rand() % 1000;
+			lb.point[1] = rand() % 1000;
+			Vec<2, float> ub;
+			ub.point[0] = lb.point[0] + (rand() % 100);
+			ub.point[1] = lb.point[1] + (rand() % 100);
+
+			tree.emplace(AABB<2, float>{lb, ub}, AABB<2, float>{lb, ub});
+		}
+
+		std::vector<AABB<2, float>> boxes;
+		for (int i = 0; i != 200; ++i) {
+			const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+			boxes.push_back(AABB<2, float>{lb, lb + Vec<2, float>{50}});
+		}
+
+		std::vector<int> expected(boxes.size());
+		for (size_t i = 0; i != boxes.size(); ++i) {
+			tree.query(boxes[i], [&expected, i](auto) {
+				++expected[i];
+				return true;
+			});
+		}
+
+		for (biss::uint threads : {0, 1, 3}) {
+			ThreadPool pool(threads);
+			REQUIRE(pool.workersCount() == threads + 1);
+
+			std::vector<std::atomic<int>> found(boxes.size());
+			tree.queryBatch(boxes, [&tree, &boxes, &found](biss::uint boxIdx, index_t idx) {
+				if (!tree[idx].isIntersecting(boxes[boxIdx])) {
+					found[boxIdx] = -1000;
+				}
+				++found[boxIdx];
+				return true;
+			}, pool);
+
+			for (size_t i = 0; i != boxes.size(); ++i) {
+				REQUIRE(found[i] == expected[i]);
+			}
+		}
+	}
+
+	SECTION("Optimize and rebuild") {
+		AABBTree<AABB<2, float>, 2, float> tree(1.0f);
+		AABBTree<AABB<2, float>, 2, float> autoTree(1.0f);
+		autoTree.setRebuildRatio(1.2f);
+
+		std::vector<index_t> idxs;
+		std::vector<index_t> autoIdxs;
+		std::vector<AABB<2, float>> aabbs;
+		for (int i = 0; i != 2000; ++i) {
+			Vec<2, float> lb;
+			lb.point[0] = rand() % 1000;
+			lb.point[1] = rand() % 1000;
+			const auto aabb = AABB<2, float>{lb, lb + Vec<2, float>{5}};
+			idxs.push_back(tree.emplace(aabb, aabb));
+			autoIdxs.push_back(autoTree.emplace(aabb, aabb));
+			aabbs.push_back(aabb);
+		}
+		REQUIRE(autoTree.cost() < tree.cost());
+
+		const auto checkQuery = [&aabbs](auto& tree) {
+			for (int i = 0; i != 50; ++i) {
+				const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+				const AABB<2, float> tester{lb, lb + Vec<2, float>{100}};
+
+				int count = 0;
+				for (const auto& aabb : aabbs) {
+					count += tester.isIntersecting(aabb);
+				}
+				tree.query(tester, [&count, &tester](auto it) {
+					count -= it->isIntersecting(tester);
+					return true;
+				});
+				REQUIRE(count == 0);
+			}
+		};
+
+		for (int step = 0; step != 20; ++step) {
+			for (size_t i = 0; i != idxs.size(); ++i) {
+				Vec<2, float> d;
+				d.point[0] = (rand() % 21) - 10;
+				d.point[1] = (rand() % 21) - 10;
+				aabbs[i].lb += d;
+				aabbs[i].ub += d;
+				tree[idxs[i]] = aabbs[i];
+				tree.update(idxs[i], aabbs[i]);
+				autoTree[autoIdxs[i]] = aabbs[i];
+				autoTree.update(autoIdxs[i], aabbs[i]);
+			}
+		}
+		checkQuery(autoTree);
+
+		const auto cost = tree.cost();
+		biss::uint rebuilt = 0;
+		for (int i = 0; i != 100; ++i) {
+			rebuilt += tree.optimize(64);
+		}
+		REQUIRE(rebuilt > 0);
+		REQUIRE(tree.cost() < cost);
+		REQUIRE(tree.count() == idxs.size());
+		checkQuery(tree);
+
+		tree.rebuild();
+		REQUIRE(tree.cost() <= autoTree.cost() * 1.2f);
+		REQUIRE(tree.count() == idxs.size());
+		checkQuery(tree);
+		// Leaf indices stay valid
+		for (const auto idx : idxs) {
+			tree.remove(idx);
+		}
+		REQUIRE(tree.count() == 0);
+	}
+
+	SECTION("Reserve") {
+		AABBTree<int, 2, float> tree;
+		REQUIRE(tree.reserve(199, 100));
+		std::vector<index_t> idxs;
+		for (int i = 0; i != 100; ++i) {
+			const Vec<2, float> lb(rand() % 100, rand() % 100);
+			idxs.push_back(tree.emplace(AABB<2, float>{lb, lb + Vec<2, float>{1}}, i));
+		}
+		for (int i = 0; i != 100; ++i) {
+			REQUIRE(tree[idxs[i]] == i);
+		}
+
+		for (int i = 50; i != 100; ++i) {
+			tree.remove(idxs[i]);
+		}
+		REQUIRE(tree.shrinkToFit());
+		REQUIRE(tree.count() == 50);
+		for (int i = 0; i != 50; ++i) {
+			REQUIRE(tree[idxs[i]] == i);
+		}
+	}
+
+	SECTION("Query hits") {
+		using Tree = AABBTree<int, 2, float>;
+		Tree tree;
+		std::vector<index_t> idxs;
+		for (int i = 0; i != 100; ++i) {
+			const Vec<2, float> lb(i);
+			idxs.push_back(tree.emplace(AABB<2, float>{lb, lb + Vec<2, float>{0.5f}}, i));
+		}
+		// Leading slots are free now
+		for (int i = 0; i != 10; ++i) {
+			tree.remove(idxs[i]);
+		}
+
+		const AABB<2, float> tester{Vec<2, float>{0}, Vec<2, float>{20.2f}};
+		std::set<int> handles;
+		tree.query(tester, [&handles, &idxs](Tree::Handle hit) {
+			REQUIRE(hit.idx() == idxs[*hit]);
+			handles.insert(*hit);
+			return true;
+		});
+		std::set<int> iterators;
+		tree.query(tester, [&iterators, &idxs](const Tree::Iterator& it) {
+			REQUIRE(it.idx() == idxs[*it]);
+			iterators.insert(*it);
+			return true;
+		});
+		std::vector<index_t> hits{nullindex};
+		REQUIRE(tree.query(tester, hits) == 11);
+		REQUIRE(hits.size() == 12);
+
+		std::set<int> buffered;
+		for (size_t i = 1; i != hits.size(); ++i) {
+			buffered.insert(tree[hits[i]]);
+		}
+		std::set<int> expected;
+		for (int i = 10; i != 21; ++i) {
+			expected.insert(i);
+		}
+		REQUIRE(handles == expected);
+		REQUIRE(iterators == expected);
+		REQUIRE(buffered == expected);
+	}
+
+	SECTION("Compact") {
+		using Tree = AABBTree<int, 2, float>;
+		Tree tree(1.0f);
+		std::vector<index_t> idxs;
+		std::vector<AABB<2, float>> aabbs;
+		for (int i = 0; i != 1000; ++i) {
+			const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+			aabbs.push_back(AABB<2, float>{lb, lb + Vec<2, float>(rand() % 20)});
+			idxs.push_back(tree.emplace(aabbs.back(), i));
+		}
+		for (int i = 0; i < 1000; i += 3) {
+			tree.remove(idxs[i]);
+			idxs[i] = nullindex;
+		}
+		tree.queryMovedPairs([](index_t, index_t) { return true; });
+		for (int i = 1; i < 1000; i += 3) {
+			aabbs[i].lb += Vec<2, float>(5);
+			aabbs[i].ub += Vec<2, float>(5);
+			tree.update(idxs[i], aabbs[i]);
+		}
+
+		for (const auto layout : {Tree::Layout::DepthFirst, Tree::Layout::VanEmdeBoas}) {
+			const auto remap = tree.compact(layout);
+			for (auto& idx : idxs) {
+				if (idx != nullindex) {
+					idx = remap[idx];
+				}
+			}
+
+			for (int i = 0; i != 1000; ++i) {
+				if (idxs[i] != nullindex) {
+					REQUIRE(tree[idxs[i]] == i);
+				}
+			}
+
+			for (int i = 0; i != 50; ++i) {
+				const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+				const AABB<2, float> tester{lb, lb + Vec<2, float>{100}};
+
+				std::set<int> expected;
+				for (int j = 0; j != 1000; ++j) {
+					if (idxs[j] != nullindex && aabbs[j].isIntersecting(tester)) {
+						expected.insert(j);
+					}
+				}
+				std::set<int> found;
+				tree.query(tester, [&found, &idxs, &tester](Tree::Handle hit) {
+					REQUIRE(idxs[*hit] == hit.idx());
+					found.insert(*hit);
+					return true;
+				});
+				// Tree AABBs are fat
+				for (const auto i : expected) {
+					REQUIRE(found.count(i) == 1);
+				}
+			}
+		}
+
+		// Moved leaves are still reported after renumbering
+		std::set<index_t> moved;
+		tree.queryMovedPairs([&moved](index_t a, index_t b) {
+			moved.insert(a);
+			moved.insert(b);
+			return true;
+		});
+		for (const auto idx : moved) {
+			REQUIRE(tree[idx] % 3 != 0);
+		}
+		REQUIRE(!moved.empty());
+
+		tree.remove(idxs[1]);
+		REQUIRE(tree.count() == 665);
+	}
+
+	SECTION("Inline values") {
+		using Tree = AABBTree<int, 2, float>;
+		static_assert(Tree::INLINE_VALUES);
+		static_assert(!AABBTree<AABB<2, float>, 2, float>::INLINE_VALUES);
+
+		Tree tree;
+		REQUIRE(tree.begin() == tree.end());
+
+		std::vector<index_t> idxs;
+		for (int i = 0; i != 100; ++i) {
+			const Vec<2, float> lb(rand() % 100, rand() % 100);
+			idxs.push_back(tree.emplace(AABB<2, float>{lb, lb + Vec<2, float>{1}}, i));
+		}
+		std::set<int> expected;
+		for (int i = 0; i != 100; ++i) {
+			if (i % 4 == 0) {
+				tree.remove(idxs[i]);
+			} else {
+				tree[idxs[i]] += 1000;
+				expected.insert(i + 1000);
+			}
+		}
+		REQUIRE(tree.count() == expected.size());
+
+		std::set<int> values;
+		for (const auto value : tree) {
+			values.insert(value);
+		}
+		REQUIRE(values == expected);
+
+		for (auto it = tree.begin(); it != tree.end(); ++it) {
+			REQUIRE(tree[it.idx()] == *it);
+		}
+
+		const std::vector<std::pair<AABB<2, float>, int>> items{{AABB<2, float>{Vec<2, float>{0}, Vec<2, float>{1}}, 7}};
+		tree.build(items.begin(), items.end());
+		REQUIRE(tree.count() == expected.size() + 1);
+		int hits = 0;
+		tree.query(AABB<2, float>{Vec<2, float>{0}, Vec<2, float>{1}}, [&hits](Tree::Handle hit) {
+			hits += *hit == 7;
+			return true;
+		});
+		REQUIRE(hits == 1);
+	}
+
+	SECTION("Stackless query") {
+		using Tree = AABBTree<int, 2, float>;
+		Tree tree;
+		int hits = 0;
+		tree.queryStackless(AABB<2, float>{Vec<2, float>{0}, Vec<2, float>{1000}}, [&hits](Tree::Handle) {
+			++hits;
+			return true;
+		});
+		REQUIRE(hits == 0);
+
+		for (int i = 0; i != 1000; ++i) {
+			const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+			tree.emplace(AABB<2, float>{lb, lb + Vec<2, float>(rand() % 50)}, i);
+		}
+
+		for (int i = 0; i != 50; ++i) {
+			const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+			const AABB<2, float> tester{lb, lb + Vec<2, float>{100}};
+
+			std::vector<int> expected;
+			tree.query(tester, [&expected](Tree::Handle hit) {
+				expected.push_back(*hit);
+				return true;
+			});
+			std::vector<int> found;
+			tree.queryStackless(tester, [&found](const Tree::Iterator& it) {
+				found.push_back(*it);
+				return true;
+			});
+			std::sort(expected.begin(), expected.end());
+			std::sort(found.begin(), found.end());
+			REQUIRE(found == expected);
+
+			int count = 0;
+			tree.queryStackless(tester, [&count](Tree::Handle) { return ++count != 2; });
+			REQUIRE(count == std::min<int>(2, expected.size()));
+		}
+	}
+
+	SECTION("Memory resources") {
+		CountingResource nodesResource;
+		CountingResource dataResource;
+		{
+			using Tree = AABBTree<std::vector<int>, 2, float>;
+			Tree tree(0, 0, &nodesResource, &dataResource);
+			REQUIRE(nodesResource.allocations == 0);
+			REQUIRE(dataResource.allocations == 0);
+
+			std::vector<index_t> idxs;
+			for (int i = 0; i != 1000; ++i) {
+				const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+				idxs.push_back(tree.emplace(AABB<2, float>{lb, lb + Vec<2, float>(rand() % 50)}, std::vector<int>{i}));
+			}
+			REQUIRE(nodesResource.blocks > 0);
+			REQUIRE(dataResource.blocks > 0);
+
+			for (int i = 0; i != 1000; i += 2) {
+				const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+				tree.update(idxs[i], AABB<2, float>{lb, lb + Vec<2, float>(10)});
+			}
+			const auto dataAllocations = dataResource.allocations;
+			tree.compact();
+			tree.rebuild();
+			REQUIRE(dataResource.allocations == dataAllocations);
+
+			int count = 0;
+			tree.query(AABB<2, float>{Vec<2, float>{0}, Vec<2, float>{2000}}, [&count](Tree::Handle hit) {
+				REQUIRE(hit->size() == 1);
+				++count;
+				return true;
+			});
+			REQUIRE(count == 1000);
+		}
+		REQUIRE(nodesResource.blocks == 0);
+		REQUIRE(dataResource.blocks == 0);
+
+		// Arena owns every block, the tree only returns them
+		std::pmr::monotonic_buffer_resource arena;
+		{
+			AABBTree<int, 2, float> tree(0, 0, &arena, &arena);
+			for (int i = 0; i != 1000; ++i) {
+				const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+				tree.emplace(AABB<2, float>{lb, lb + Vec<2, float>(5)}, i);
+			}
+			REQUIRE(tree.count() == 1000);
+		}
+		arena.release();
+	}
+
+	SECTION("Save and view") {
+		struct Item {
+			int id;
+			float weight;
+		};
+		using Tree = AABBTree<Item, 2, float>;
+		using View = AABBTreeView<Item, 2, float>;
+
+		Tree tree;
+		std::vector<index_t> idxs;
+		for (int i = 0; i != 1000; ++i) {
+			const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+			idxs.push_back(tree.emplace(AABB<2, float>{lb, lb + Vec<2, float>(rand() % 50)}, Item{i, i * 0.5f}));
+		}
+		for (int i = 0; i < 1000; i += 3) {
+			tree.remove(idxs[i]);
+		}
+
+		std::stringstream stream;
+		REQUIRE(tree.save(stream));
+		const auto snapshot = stream.str();
+		// Arrays in the snapshot are aligned relative to its start
+		std::vector<std::uint64_t> buffer(snapshot.size() / sizeof(std::uint64_t) + 1);
+		std::memcpy(buffer.data(), snapshot.data(), snapshot.size());
+
+		const auto check = [&tree](const View& view) {
+			REQUIRE(view.count() == tree.count());
+			for (int i = 0; i != 50; ++i) {
+				const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+				const AABB<2, float> tester{lb, lb + Vec<2, float>{100}};
+
+				std::vector<index_t> expected;
+				tree.query(tester, expected);
+				std::vector<index_t> found;
+				view.query(tester, [&view, &tree, &found](View::Handle hit) {
+					REQUIRE(hit->id == tree[hit].id);
+					REQUIRE(hit->weight == tree[hit].weight);
+					REQUIRE(&*hit == &view[hit]);
+					found.push_back(hit);
+					return true;
+				});
+				std::sort(expected.begin(), expected.end());
+				std::sort(found.begin(), found.end());
+				REQUIRE(found == expected);
+			}
+		};
+
+		View view;
+		REQUIRE(view.open(buffer.data(), snapshot.size()));
+		check(view);
+
+		// Truncated snapshots and other tree types are rejected
+		View truncated;
+		REQUIRE(!truncated.open(buffer.data(), snapshot.size() - 1));
+		REQUIRE(!truncated.isOpen());
+		AABBTreeView<Item, 2, double> other;
+		REQUIRE(!other.open(buffer.data(), snapshot.size()));
+
+		// Corrupt hierarchies are rejected by full validation, whatever is accepted is a valid tree
+		AABBTreeSnapshotHeader header;
+		std::memcpy(&header, snapshot.data(), sizeof(header));
+		const auto nodesWords = header.nodesCapacity * header.nodeSize / sizeof(std::uint32_t);
+		for (int i = 0; i != 500; ++i) {
+			auto corrupted = buffer;
+			auto* words = reinterpret_cast<std::uint32_t*>(
+			    reinterpret_cast<char*>(corrupted.data()) + header.nodesOffset);
+			const std::uint32_t values[] = {std::uint32_t(rand() % header.nodesCapacity), std::uint32_t(header.root),
+			    std::uint32_t(header.nodesCapacity), ~std::uint32_t(0)};
+			words[rand() % nodesWords] = values[rand() % 4];
+
+			View view;
+			if (view.open(corrupted.data(), snapshot.size(), View::Validate::Full)) {
+				std::vector<index_t> hits;
+				view.query(AABB<2, float>{Vec<2, float>{-1e6f}, Vec<2, float>{1e6f}}, hits);
+				// Bounds aren't validated, a broken box may hide its leaf
+				REQUIRE(hits.size() <= tree.count());
+				for (auto hit : hits) {
+					// Inline values lie in nodes and may be broken as well
+					const auto& item = view[hit];
+					REQUIRE((Tree::INLINE_VALUES || item.id < 1000));
+				}
+			}
+		}
+		auto corrupted = buffer;
+		std::memset(reinterpret_cast<char*>(corrupted.data()) + header.nodesOffset, 0xff,
+		    header.nodesCapacity * header.nodeSize);
+		REQUIRE(!View().open(corrupted.data(), snapshot.size(), View::Validate::Full));
+		// Default open only checks the header and never reads nodes
+		REQUIRE(View().open(corrupted.data(), snapshot.size()));
+		corrupted = buffer;
+		reinterpret_cast<AABBTreeSnapshotHeader*>(corrupted.data())->count += 1;
+		REQUIRE(!View().open(corrupted.data(), snapshot.size(), View::Validate::Full));
+
+		const auto path = std::filesystem::temp_directory_path() / "aabb_tree_snapshot.bin";
+		REQUIRE(tree.save(path));
+		View validated;
+		REQUIRE(validated.open(path, View::Validate::Full));
+		check(validated);
+		View mapped;
+		REQUIRE(mapped.open(path));
+		check(mapped);
+		View moved(std::move(mapped));
+		REQUIRE(!mapped.isOpen());
+		check(moved);
+		moved.close();
+		validated.close();
+		std::filesystem::remove(path);
+
+		// Inline values live in nodes, snapshot has no value array
+		AABBTree<int, 2, float> small;
+		for (int i = 0; i != 100; ++i) {
+			const Vec<2, float> lb(rand() % 100, rand() % 100);
+			small.emplace(AABB<2, float>{lb, lb + Vec<2, float>(5)}, i);
+		}
+		std::stringstream smallStream;
+		REQUIRE(small.save(smallStream));
+		const auto smallSnapshot = smallStream.str();
+		std::vector<std::uint64_t> smallBuffer(smallSnapshot.size() / sizeof(std::uint64_t) + 1);
+		std::memcpy(smallBuffer.data(), smallSnapshot.data(), smallSnapshot.size());
+		AABBTreeView<int, 2, float> smallView;
+		REQUIRE(smallView.open(smallBuffer.data(), smallSnapshot.size()));
+		int sum = 0;
+		smallView.query(AABB<2, float>{Vec<2, float>{0}, Vec<2, float>{200}}, [&sum](auto hit) {
+			sum += *hit;
+			return true;
+		});
+		REQUIRE(sum == 99 * 100 / 2);
+
+		AABBTree<int, 2, float> empty;
+		std::stringstream emptyStream;
+		REQUIRE(empty.save(emptyStream));
+		const auto emptySnapshot = emptyStream.str();
+		std::vector<std::uint64_t> emptyBuffer(emptySnapshot.size() / sizeof(std::uint64_t) + 1);
+		std::memcpy(emptyBuffer.data(), emptySnapshot.data(), emptySnapshot.size());
+		AABBTreeView<int, 2, float> emptyView;
+		REQUIRE(emptyView.open(emptyBuffer.data(), emptySnapshot.size()));
+		REQUIRE(emptyView.count() == 0);
+		std::vector<index_t> hits;
+		REQUIRE(emptyView.query(AABB<2, float>{Vec<2, float>{0}, Vec<2, float>{200}}, hits) == 0);
+	}
+
+	SECTION("Frozen tree") {
+		using Tree = AABBTree<std::string, 2, float>;
+		Tree tree;
+		std::vector<index_t> idxs;
+		for (int i = 0; i != 1000; ++i) {
+			const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+			idxs.push_back(
+			    tree.emplace(AABB<2, float>{lb, lb + Vec<2, float>(1 + rand() % 50)}, std::to_string(i)));
+		}
+		for (int i = 0; i < 1000; i += 4) {
+			tree.remove(idxs[i]);
+		}
+
+		const auto check = [&tree](const auto& frozen) {
+			REQUIRE(frozen.count() == tree.count());
+			REQUIRE(frozen.nodesCount() == 2 * tree.count() - 1);
+
+			for (int i = 0; i != 100; ++i) {
+				const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+				const AABB<2, float> tester{lb, lb + Vec<2, float>{float(rand() % 100)}};
+
+				std::vector<index_t> expected;
+				tree.query(tester, expected);
+				std::set<index_t> found;
+				frozen.query(tester, [&tree, &found](auto hit) {
+					REQUIRE(*hit == tree[hit]);
+					found.insert(hit);
+					return true;
+				});
+				// Quantised bounds are conservative
+				for (const auto idx : expected) {
+					REQUIRE(found.count(idx) == 1);
+				}
+
+				const Vec<2, float> origin(rand() % 1000, rand() % 1000);
+				const Vec<2, float> direction(rand() % 200 - 100, rand() % 200 - 100);
+				float closest = 2;
+				tree.raycast(origin, direction, 1.0f, [&closest](index_t, float fraction) {
+					closest = fraction;
+					return fraction;
+				});
+				float frozenClosest = 2;
+				frozen.raycast(origin, direction, 1.0f, [&frozenClosest](index_t, float fraction) {
+					frozenClosest = fraction;
+					return fraction;
+				});
+				REQUIRE(frozenClosest <= closest);
+			}
+		};
+
+		FrozenAABBTree<std::string, 2, float> frozen(tree);
+		check(frozen);
+		FrozenAABBTree<std::string, 2, float, std::uint8_t> frozen8(tree);
+		check(frozen8);
+		// With 64 bit indices both node types are padded to the same size
+		REQUIRE(frozen8.memoryUsage() <= frozen.memoryUsage());
+		if (sizeof(index_t) == 4) {
+			REQUIRE(frozen8.memoryUsage() < frozen.memoryUsage());
+		}
+
+		const Tree empty;
+		FrozenAABBTree<std::string, 2, float> frozenEmpty(empty);
+		std::vector<index_t> hits;
+		REQUIRE(frozenEmpty.query(AABB<2, float>{Vec<2, float>{0}, Vec<2, float>{1000}}, hits) == 0);
+
+		// Integer keys are decoded in double precision
+		AABBTree<int, 2, int> intTree;
+		for (int i = 0; i != 500; ++i) {
+			const Vec<2, int> lb(rand() % 1000, rand() % 1000);
+			intTree.emplace(AABB<2, int>{lb, lb + Vec<2, int>(rand() % 20)}, i);
+		}
+		FrozenAABBTree<int, 2, int, std::uint8_t> frozenInt(intTree);
+		for (int i = 0; i != 100; ++i) {
+			const Vec<2, int> lb(rand() % 1000, rand() % 1000);
+			const AABB<2, int> tester{lb, lb + Vec<2, int>{rand() % 50}};
+			std::vector<index_t> expected;
+			intTree.query(tester, expected);
+			std::vector<index_t> found;
+			frozenInt.query(tester, found);
+			std::sort(found.begin(), found.end());
+			for (const auto idx : expected) {
+				REQUIRE(std::binary_search(found.begin(), found.end(), idx));
+			}
+		}
+
+		// Far from the origin bounds are widened by about an ulp of the coordinates, not more
+		const float offset = 1e5f;
+		AABBTree<int, 2, float> farTree;
+		std::vector<std::pair<AABB<2, float>, int>> farObjects;
+		for (int i = 0; i != 5000; ++i) {
+			const Vec<2, float> lb(offset + (rand() % 10000) / 100.f, offset + (rand() % 10000) / 100.f);
+			farObjects.emplace_back(AABB<2, float>{lb, lb + Vec<2, float>(0.5f)}, i);
+		}
+		std::vector<index_t> farIdxs;
+		farTree.build(farObjects.begin(), farObjects.end(), std::back_inserter(farIdxs));
+		FrozenAABBTree<int, 2, float> frozenFar(farTree);
+
+		std::size_t exactHits = 0;
+		std::size_t frozenHits = 0;
+		for (int i = 0; i != 200; ++i) {
+			const Vec<2, float> lb(offset + (rand() % 10000) / 100.f, offset + (rand() % 10000) / 100.f);
+			const AABB<2, float> tester{lb, lb + Vec<2, float>(2)};
+			std::vector<index_t> expected;
+			exactHits += farTree.query(tester, expected);
+			std::vector<index_t> found;
+			frozenHits += frozenFar.query(tester, found);
+			std::sort(found.begin(), found.end());
+			for (const auto idx : expected) {
+				REQUIRE(std::binary_search(found.begin(), found.end(), idx));
+			}
+		}
+		REQUIRE(frozenHits <= exactHits * 11 / 10);
+
+		// A box 0.05 (about 6 ulps) away from an object doesn't reach it
+		for (int i = 0; i != 200; ++i) {
+			const auto& aabb = farObjects[i].first;
+			const AABB<2, float> beyond{Vec<2, float>(aabb.ub.point[0] + 0.05f, aabb.lb.point[1]),
+			    Vec<2, float>(aabb.ub.point[0] + 0.1f, aabb.ub.point[1])};
+			std::vector<index_t> found;
+			frozenFar.query(beyond, found);
+			REQUIRE(std::find(found.begin(), found.end(), farIdxs[i]) == found.end());
+		}
+	}
+
+	SECTION("Statistics") {
+		using Tree = AABBTree<int, 2, float>;
+		Tree tree(1);
+		auto stats = tree.stats();
+		REQUIRE(stats.height == 0);
+		REQUIRE(stats.nodesCount == 0);
+		REQUIRE(stats.nodesVisitedPerQuery() == 0);
+
+		std::vector<index_t> idxs;
+		for (int i = 0; i != 1000; ++i) {
+			const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+			idxs.push_back(tree.emplace(AABB<2, float>{lb, lb + Vec<2, float>(5)}, i));
+		}
+		stats = tree.stats();
+		REQUIRE(stats.objectsCount == 1000);
+		REQUIRE(stats.nodesCount == 1999);
+		REQUIRE(stats.nodesCapacity >= stats.nodesCount);
+		REQUIRE(stats.height >= 10);
+		REQUIRE(stats.height <= 30);
+		REQUIRE(stats.cost == tree.cost());
+		REQUIRE(stats.internalArea > 0);
+
+		tree.resetStats();
+		// Far moves leave fat AABBs
+		for (int i = 1; i < 1000; i += 2) {
+			tree.update(idxs[i], AABB<2, float>{Vec<2, float>(2000), Vec<2, float>(2005)});
+		}
+		std::vector<index_t> hits;
+		tree.query(AABB<2, float>{Vec<2, float>{0}, Vec<2, float>{100}}, hits);
+		tree.queryStackless(AABB<2, float>{Vec<2, float>{0}, Vec<2, float>{100}}, [](Tree::Handle) { return true; });
+
+		stats = tree.stats();
+		if (AABB_TREE_STATS) {
+			REQUIRE(stats.updates == 500);
+			REQUIRE(stats.updatesKept == 0);
+			REQUIRE(stats.rotations > 0);
+			REQUIRE(stats.queries == 2);
+			REQUIRE(stats.nodesVisited >= stats.leavesTested);
+			REQUIRE(stats.leavesTested >= 2 * hits.size());
+
+			tree.resetStats();
+			// Second, small move stays inside the fat AABB of the first one
+			for (int i = 0; i < 1000; i += 2) {
+				tree.update(idxs[i], AABB<2, float>{Vec<2, float>(0), Vec<2, float>(5)});
+				tree.update(idxs[i], AABB<2, float>{Vec<2, float>(0.5f), Vec<2, float>(5.5f)});
+			}
+			stats = tree.stats();
+			REQUIRE(stats.updates == 1000);
+			REQUIRE(stats.updatesKept == 500);
+			REQUIRE(stats.fatAABBHitRate() == Approx(0.5));
+		} else {
+			REQUIRE(stats.updates == 0);
+			REQUIRE(stats.rotations == 0);
+			REQUIRE(stats.queries == 0);
+			REQUIRE(stats.nodesVisited == 0);
+		}
+	}
+
+	SECTION("Snapshots") {
+		using Tree = AABBTree<std::pair<int, int>, 2, float>;
+		Tree tree(1);
+		std::vector<index_t> idxs;
+		for (int i = 0; i != 500; ++i) {
+			const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+			idxs.push_back(tree.emplace(AABB<2, float>{lb, lb + Vec<2, float>(5)}, i, 0));
+		}
+
+		Tree copy(tree);
+		REQUIRE(copy.count() == tree.count());
+		REQUIRE(copy.cost() == tree.cost());
+		for (const auto idx : idxs) {
+			REQUIRE(copy[idx] == tree[idx]);
+		}
+
+		AABBTreeSnapshots<Tree> snapshots;
+		REQUIRE(snapshots.acquire() == nullptr);
+		snapshots.publish(tree);
+
+		// Every object of a snapshot carries the frame it was published at
+		// Catch assertions aren't thread safe, readers only count failures
+		std::atomic<bool> done = false;
+		std::atomic<int> checks = 0;
+		std::atomic<int> failures = 0;
+		const auto reader = [&snapshots, &done, &checks, &failures] {
+			while (!done) {
+				const auto snapshot = snapshots.acquire();
+				const auto frame = (*snapshot)[0].second;
+				int count = 0;
+				snapshot->query(AABB<2, float>{Vec<2, float>{-100}, Vec<2, float>{2000}},
+				    [frame, &count, &failures](auto hit) {
+					    failures += hit->second != frame;
+					    ++count;
+					    return true;
+				    });
+				failures += count != 500;
+				++checks;
+			}
+		};
+		std::thread reader1(reader);
+		std::thread reader2(reader);
+
+		for (int frame = 1; frame != 100 || checks < 100; ++frame) {
+			for (int i = 0; i != 500; ++i) {
+				const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+				tree.update(idxs[i], AABB<2, float>{lb, lb + Vec<2, float>(5)});
+				tree[idxs[i]].second = frame;
+			}
+			snapshots.publish(tree);
+		}
+		done = true;
+		reader1.join();
+		reader2.join();
+		REQUIRE(failures == 0);
+
+		// Two readers hold at most two snapshots, one more is current and one is being written
+		REQUIRE(snapshots.buffersCount() <= 4);
+		REQUIRE(snapshots.acquire()->count() == 500);
+	}
+	SECTION("Parallel build") {
+		using Tree = AABBTree<int, 2, float>;
+		for (int objectsCount : {1, 100, 20000}) {
+			std::vector<std::pair<AABB<2, float>, int>> objects;
+			for (int i = 0; i != objectsCount; ++i) {
+				const Vec<2, float> lb(rand() % 10000, rand() % 10000);
+				objects.emplace_back(AABB<2, float>{lb, lb + Vec<2, float>(rand() % 100, rand() % 100)}, i);
+			}
+			// Some duplicates to get splits with equal centroids
+			for (int i = 0; i != objectsCount / 10; ++i) {
+				objects.push_back(objects[i]);
+			}
+
+			Tree expected;
+			std::vector<index_t> expectedIdxs;
+			expected.build(objects.begin(), objects.end(), std::back_inserter(expectedIdxs));
+			std::stringstream expectedImage;
+			REQUIRE(expected.save(expectedImage));
+			// Rebuild takes leaves in tree order, the result differs from build()
+			Tree rebuilt = expected;
+			rebuilt.rebuild();
+			std::stringstream expectedRebuiltImage;
+			REQUIRE(rebuilt.save(expectedRebuiltImage));
+
+			for (biss::uint threads : {0, 1, 3}) {
+				ThreadPool pool(threads);
+
+				Tree tree;
+				std::vector<index_t> idxs;
+				tree.build(objects.begin(), objects.end(), std::back_inserter(idxs), pool);
+				REQUIRE(idxs == expectedIdxs);
+				REQUIRE(tree.cost() == Approx(expected.cost()));
+
+				std::stringstream image;
+				REQUIRE(tree.save(image));
+				REQUIRE(image.str() == expectedImage.str());
+
+				tree.rebuild(pool);
+				std::stringstream rebuiltImage;
+				REQUIRE(tree.save(rebuiltImage));
+				REQUIRE(rebuiltImage.str() == expectedRebuiltImage.str());
+
+				std::size_t count = 0;
+				tree.query(AABB<2, float>{Vec<2, float>{-1}, Vec<2, float>{20000}}, [&count](auto) {
+					++count;
+					return true;
+				});
+				REQUIRE(count == objects.size());
+			}
+		}
+	}
+	SECTION("Dual tree") {
+		DualAABBTree<std::string, 2, float> tree(0.5f, 0, 3);
+		std::vector<index_t> idxs;
+		for (int i = 0; i != 300; ++i) {
+			const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+			idxs.push_back(tree.emplace(AABB<2, float>{lb, lb + Vec<2, float>{5}}, std::to_string(i)));
+		}
+		REQUIRE(tree.count() == 300);
+		REQUIRE(tree.dynamicTree().count() == 300);
+
+		const auto check = [&tree, &idxs] {
+			for (int i = 0; i != 20; ++i) {
+				const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+				const AABB<2, float> box{lb, lb + Vec<2, float>{100}};
+				std::set<index_t> expected;
+				for (auto idx : idxs) {
+					if (box.isIntersecting(tree.aabb(idx))) {
+						expected.insert(idx);
+					}
+				}
+
+				// Dynamic tree reports fat AABBs, filter them to tight ones
+				std::set<index_t> found;
+				tree.query(box, [&tree, &box, &found](index_t idx) {
+					if (box.isIntersecting(tree.aabb(idx))) {
+						REQUIRE(found.insert(idx).second);
+					}
+					return true;
+				});
+				REQUIRE(found == expected);
+			}
+		};
+
+		// First 100 objects keep moving, the rest fall asleep after 3 frames
+		for (int frame = 0; frame != 5; ++frame) {
+			for (int i = 0; i != 100; ++i) {
+				const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+				tree.update(idxs[i], AABB<2, float>{lb, lb + Vec<2, float>{5}});
+			}
+			// Unchanged AABB is not a change
+			tree.update(idxs[150], tree.aabb(idxs[150]));
+			REQUIRE(tree.staticTree().count() == (frame < 3 ? 0 : 200));
+			check();
+			tree.step();
+		}
+		for (int i = 0; i != 300; ++i) {
+			REQUIRE(tree.isStatic(idxs[i]) == (i >= 100));
+			REQUIRE(tree[idxs[i]] == std::to_string(i));
+		}
+
+		// Wakes up on change and sleeps again
+		const AABB<2, float> moved{Vec<2, float>{2000}, Vec<2, float>{2010}};
+		tree.update(idxs[200], moved);
+		REQUIRE(!tree.isStatic(idxs[200]));
+		REQUIRE(tree.staticTree().count() == 199);
+		REQUIRE(tree.dynamicTree().count() == 101);
+		check();
+		for (int frame = 0; frame != 3; ++frame) {
+			tree.step();
+		}
+		REQUIRE(tree.isStatic(idxs[200]));
+		REQUIRE(tree.aabb(idxs[200]).lb.point[0] == 2000);
+
+		// Static object in front of a dynamic one, then the other way round
+		const auto castHit = [&tree] {
+			index_t hit = nullindex;
+			tree.raycast(Vec<2, float>{1900, 2005}, Vec<2, float>{1, 0}, 1000, [&hit](index_t idx, float fraction) {
+				hit = idx;
+				return fraction;
+			});
+			return hit;
+		};
+		const auto idx = tree.emplace(AABB<2, float>{Vec<2, float>{2100, 2000}, Vec<2, float>{2110, 2010}}, "new");
+		REQUIRE(castHit() == idxs[200]);
+		tree.update(idx, AABB<2, float>{Vec<2, float>{1950, 2000}, Vec<2, float>{1960, 2010}});
+		REQUIRE(castHit() == idx);
+
+		for (auto i : idxs) {
+			tree.remove(i);
+		}
+		idxs = {idx};
+		tree.step();
+		REQUIRE(tree.count() == 1);
+		REQUIRE(tree.staticTree().count() + tree.dynamicTree().count() == 1);
+		check();
+	}
+	SECTION("Convex query") {
+		using Tree = AABBTree<int, 3, float>;
+		const auto vec = [](float x, float y, float z) {
+			Vec<3, float> v;
+			v.point[0] = x;
+			v.point[1] = y;
+			v.point[2] = z;
+			return v;
+		};
+
+		Tree tree;
+		std::vector<std::pair<AABB<3, float>, int>> objects;
+		for (int i = 0; i != 2000; ++i) {
+			const auto lb = vec(rand() % 1000, rand() % 1000, rand() % 1000);
+			objects.emplace_back(AABB<3, float>{lb, lb + vec(rand() % 20, rand() % 20, rand() % 20)}, i);
+		}
+		tree.build(objects.begin(), objects.end());
+
+		const auto convexQuery = [&tree](const std::vector<Tree::Plane_t>& planes) {
+			std::set<int> found;
+			tree.queryConvex(planes, [&found](auto hit) {
+				REQUIRE(found.insert(*hit).second);
+				return true;
+			});
+			return found;
+		};
+
+		// Octahedron |x - 500| + |y - 500| + |z - 500| <= 300, small integers keep the arithmetic exact
+		std::vector<Tree::Plane_t> planes;
+		for (int i = 0; i != 8; ++i) {
+			const auto normal = vec(i & 1 ? 1 : -1, i & 2 ? 1 : -1, i & 4 ? 1 : -1);
+			planes.push_back(Tree::Plane_t{normal, 500 * (normal.point[0] + normal.point[1] + normal.point[2]) + 300});
+		}
+
+		std::set<int> expected;
+		for (const auto& [aabb, value] : objects) {
+			bool outside = false;
+			for (const auto& plane : planes) {
+				float nearest = 0;
+				for (biss::uint axis = 0; axis != 3; ++axis) {
+					const auto n = plane.normal.point[axis];
+					nearest += n * (n > 0 ? aabb.lb.point[axis] : aabb.ub.point[axis]);
+				}
+				outside |= nearest > plane.distance;
+			}
+			if (!outside) {
+				expected.insert(value);
+			}
+		}
+		REQUIRE(!expected.empty());
+		REQUIRE(expected.size() < objects.size());
+		REQUIRE(convexQuery(planes) == expected);
+
+		// Everything is inside: only the root is tested
+		std::vector<Tree::Plane_t> box;
+		for (biss::uint axis = 0; axis != 3; ++axis) {
+			Vec<3, float> normal(0);
+			normal.point[axis] = 1;
+			box.push_back(Tree::Plane_t{normal, 2000});
+			normal.point[axis] = -1;
+			box.push_back(Tree::Plane_t{normal, 1000});
+		}
+		tree.resetStats();
+		REQUIRE(convexQuery(box).size() == objects.size());
+		REQUIRE(convexQuery({}).size() == objects.size());
+		if (AABB_TREE_STATS) {
+			REQUIRE(tree.stats().nodesVisited == 1);
+		}
+
+		int count = 0;
+		REQUIRE(tree.queryConvex(planes, [&count](auto) {
+			++count;
+			return false;
+		}));
+		REQUIRE(count == 1);
+
+		// Full plane mask, then one plane too many
+		std::vector<Tree::Plane_t> many(planes);
+		while (many.size() != Tree::MAX_CONVEX_PLANES) {
+			many.push_back(planes[many.size() % planes.size()]);
+		}
+		REQUIRE(convexQuery(many) == expected);
+		many.push_back(planes[0]);
+		count = 0;
+		REQUIRE(!tree.queryConvex(many, [&count](auto) {
+			++count;
+			return true;
+		}));
+		REQUIRE(count == 0);
+	}
+	SECTION("Move") {
+		const auto fill = [](auto& tree, int count) {
+			for (int i = 0; i != count; ++i) {
+				const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+				tree.emplace(AABB<2, float>{lb, lb + Vec<2, float>{10}}, std::to_string(i));
+			}
+		};
+		const auto countAll = [](const auto& tree) {
+			int count = 0;
+			tree.query(AABB<2, float>{Vec<2, float>{-100}, Vec<2, float>{2000}}, [&count](auto) {
+				++count;
+				return true;
+			});
+			return count;
+		};
+
+		AABBTree<std::string, 2, float> a(1);
+		AABBTree<std::string, 2, float> b(1);
+		fill(a, 50);
+		fill(b, 100);
+
+		a = std::move(b);
+		REQUIRE(a.count() == 100);
+		REQUIRE(countAll(a) == 100);
+		REQUIRE(b.count() == 0);
+		REQUIRE(countAll(b) == 0);
+		REQUIRE(b.cost() == 0);
+
+		// Moved from trees are empty and usable
+		fill(b, 30);
+		REQUIRE(b.count() == 30);
+		REQUIRE(countAll(b) == 30);
+		int pairs = 0;
+		b.queryMovedPairs([&pairs](index_t, index_t) {
+			++pairs;
+			return true;
+		});
+
+		AABBTree<std::string, 2, float> c(std::move(a));
+		REQUIRE(c.count() == 100);
+		REQUIRE(countAll(c) == 100);
+		REQUIRE(a.count() == 0);
+		fill(a, 20);
+		REQUIRE(countAll(a) == 20);
+		a.rebuild();
+		REQUIRE(countAll(a) == 20);
+
+		AABBTree<int, 2, float> inlineTree;
+		for (int i = 0; i != 10; ++i) {
+			inlineTree.emplace(AABB<2, float>{Vec<2, float>(i), Vec<2, float>(i + 1)}, i);
+		}
+		auto other = std::move(inlineTree);
+		REQUIRE(other.count() == 10);
+		REQUIRE(inlineTree.count() == 0);
+		inlineTree.emplace(AABB<2, float>{Vec<2, float>(0), Vec<2, float>(1)}, 1);
+		REQUIRE(countAll(inlineTree) == 1);
+	}
+	SECTION("Nested parallel for") {
+		for (biss::uint threads : {0, 1, 3}) {
+			ThreadPool pool(threads);
+			std::vector<std::atomic<int>> calls(64 * 64);
+			std::atomic<int> wrongWorker = 0;
+			pool.parallelFor(64, 1, [&pool, &calls, &wrongWorker](biss::uint worker, biss::uint i) {
+				pool.parallelFor(64, 4, [&calls, &wrongWorker, worker, i](biss::uint nestedWorker, biss::uint j) {
+					wrongWorker += nestedWorker != worker;
+					++calls[i * 64 + j];
+				});
+			});
+			REQUIRE(wrongWorker == 0);
+			for (const auto& count : calls) {
+				REQUIRE(count == 1);
+			}
+
+			// Nested build through an executor callback
+			std::vector<AABBTree<int, 2, float>> trees(2);
+			std::vector<std::pair<AABB<2, float>, int>> objects;
+			for (int i = 0; i != 5000; ++i) {
+				const Vec<2, float> lb(rand() % 1000, rand() % 1000);
+				objects.emplace_back(AABB<2, float>{lb, lb + Vec<2, float>{5}}, i);
+			}
+			pool.parallelFor(trees.size(), 1, [&pool, &trees, &objects](biss::uint, biss::uint i) {
+				std::vector<index_t> idxs;
+				trees[i].build(objects.begin(), objects.end(), std::back_inserter(idxs), pool);
+			});
+			for (const auto& tree : trees) {
+				REQUIRE(tree.count() == objects.size());
+			}
+		}
+	}
 }
\ No newline at end of file